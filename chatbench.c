@@ -0,0 +1,226 @@
+/*
+ * End-to-end client benchmark: the client's receive path, from the
+ * socket to pixels on a memory surface, fed by loadgen through
+ * chatserver
+ *
+ * Usage: chatbench [-d seconds] [host[:port]]
+ *
+ * Connects like the client, shows every message the way it does (the
+ * framer, the render thread, one flush per frame) and, once messages
+ * start arriving, measures for the given number of seconds (default 5)
+ * or until none have come for a second.  Reports messages shown per
+ * second, the time from loadgen sending a message to it being on the
+ * screen and the time each flush took (see stats.h), and the CPU time
+ * of the network and render threads.
+ * FBSURFACE, FBSCALE, FBFONT and FBFPS work as they do for the client.
+ * CHATLOG=dir logs the messages too, as the client does by default.
+ */
+#include "fbputchar.h"
+#include "render.h"
+#include "conn.h"
+#include "eventloop.h"
+#include "msglog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#define SERVER_PORT 42000
+#define CHECK_MS 100       /* How often to see if it is time to stop */
+#define IDLE_MS 1000       /* Stop once nothing has come for this long */
+#define STAMPS 65536       /* Messages shown but not yet flushed */
+
+static struct conn server;
+static long seconds = 5;
+static int framems, frametimer, framepending;
+static long long lastframe;
+
+/* Sending times, from loadgen, of the messages given to the render
+   thread; the ones from drawn up to stamped are not on screen yet */
+static long long stamps[STAMPS];
+static unsigned long stamped;
+static atomic_ulong drawn;
+
+static struct msglog chatlog;
+static int logging;
+
+static struct stats_hist recvpixel;
+static long long lastdrawn;
+
+static unsigned long messages;
+static long long first, last;  /* When the first and latest arrived */
+static long long cpufirst, threadfirst;
+
+static long long ns(clockid_t clock)
+{
+  struct timespec t;
+
+  clock_gettime(clock, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* Called by the render thread once the messages up to arg are shown */
+static void drawn_f(void *arg)
+{
+  unsigned long upto = (uintptr_t) arg, i;
+  long long now = ns(CLOCK_MONOTONIC);
+
+  for (i = atomic_load(&drawn) ; i < upto ; i++)
+    stats_record(&recvpixel, now - stamps[i % STAMPS], 1);
+  atomic_store(&drawn, upto);
+  lastdrawn = now;
+}
+
+static void frame_f(int fd, uint32_t events, void *ignored)
+{
+  framepending = 0;
+  lastframe = ns(CLOCK_MONOTONIC);
+  render_call(drawn_f, (void *) (uintptr_t) stamped);
+  render_flush();
+}
+
+/* At most one flush per frame, as in the client */
+static void redraw(void)
+{
+  long wait;
+
+  if (framepending) return;
+  wait = framems - (ns(CLOCK_MONOTONIC) - lastframe) / 1000000;
+  if (wait <= 0) {
+    frame_f(frametimer, 0, NULL);
+    return;
+  }
+  framepending = 1;
+  evloop_arm(frametimer, wait, 0);
+}
+
+static void show_message(const char *a, int alen, const char *b, int blen,
+			 void *ignored)
+{
+  char head[64];
+  int n = alen < (int) sizeof(head) - 1 ? alen : sizeof(head) - 1;
+  int m = blen < (int) sizeof(head) - 1 - n ? blen : sizeof(head) - 1 - n;
+  long long sent;
+
+  last = ns(CLOCK_MONOTONIC);
+  if (messages++ == 0) {
+    first = last;
+    cpufirst = ns(CLOCK_PROCESS_CPUTIME_ID);
+    threadfirst = ns(CLOCK_THREAD_CPUTIME_ID);
+  }
+
+  /* "user<n> <sequence> <sent>", from loadgen */
+  memcpy(head, a, n);
+  memcpy(head + n, b, m);
+  head[n + m] = 0;
+  if (sscanf(head, "%*s %*u %lld", &sent) == 1 &&
+      stamped - atomic_load(&drawn) < STAMPS)
+    stamps[stamped++ % STAMPS] = sent;
+
+  render_span(0, a, alen);
+  render_span(0, b, blen);
+  render_end(0);
+  if (logging)
+    msglog_append(&chatlog, MSGLOG_RECEIVED, 0, a, alen, b, blen);
+  redraw();
+}
+
+static void status_f(struct conn *c, void *ignored)
+{
+}
+
+static void check_f(int fd, uint32_t events, void *ignored)
+{
+  long long now = ns(CLOCK_MONOTONIC);
+
+  if (messages > 0 && (now - first >= seconds * 1000000000LL ||
+		       now - last >= IDLE_MS * 1000000LL))
+    evloop_stop();
+}
+
+int main(int argc, char *argv[])
+{
+  const char *spec = getenv("FBSURFACE"), *font = getenv("FBFONT");
+  const char *logdir = getenv("CHATLOG");
+  int scale = getenv("FBSCALE") ? atoi(getenv("FBSCALE")) : FB_DEFAULTSCALE;
+  struct sockaddr_in addr;
+  long long cpu, thread;
+  double secs;
+  int opt, checker;
+
+  while ( (opt = getopt(argc, argv, "d:")) != -1 )
+    switch (opt) {
+    case 'd': seconds = atol(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-d seconds] [host[:port]]\n", argv[0]);
+      exit(1);
+    }
+  if ( conn_resolve(&addr, optind < argc ? argv[optind] : "127.0.0.1",
+		    SERVER_PORT) < 0 ) {
+    fprintf(stderr, "Error: Could not find \"%s\"\n", argv[optind]);
+    exit(1);
+  }
+
+  if (font != NULL && fbsetfont(font) != 0) {
+    fprintf(stderr, "Error: Could not load the font %s\n", font);
+    exit(1);
+  }
+  if (fbopen_surface(spec != NULL ? spec : "mem", scale) != 0) {
+    fprintf(stderr, "Error: Could not open the surface\n");
+    exit(1);
+  }
+  fbclear();
+  framems = fbframems(getenv("FBFPS"));
+  if (logdir != NULL && *logdir != '\0') {
+    if (msglog_open(&chatlog, logdir) < 0) {
+      fprintf(stderr, "Error: Could not open the message log %s\n", logdir);
+      exit(1);
+    }
+    logging = 1;
+  }
+  stats_register(&recvpixel, "recv");
+  if (render_start() < 0) {
+    fprintf(stderr, "Error: Could not start the render thread\n");
+    exit(1);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  srand(time(NULL) ^ getpid());
+  if ( evloop_init() < 0 ||
+       (frametimer = evloop_timer(frame_f, NULL)) < 0 ||
+       (checker = evloop_timer(check_f, NULL)) < 0 ||
+       conn_init(&server, &addr, show_message, status_f, NULL) < 0 ) {
+    fprintf(stderr, "Error: Could not create the event loop\n");
+    exit(1);
+  }
+  evloop_arm(checker, CHECK_MS, CHECK_MS);
+
+  evloop_run();
+
+  /* Whatever is still queued is drawn before the clocks are read.  The
+     CPU time is over the time there was work to do. */
+  conn_close(&server);
+  frame_f(frametimer, 0, NULL);
+  render_stop();
+  if (logging) msglog_close(&chatlog);
+  cpu = ns(CLOCK_PROCESS_CPUTIME_ID) - cpufirst;
+  thread = ns(CLOCK_THREAD_CPUTIME_ID) - threadfirst;
+  secs = ((lastdrawn > last ? lastdrawn : last) - first) / 1e9;
+
+  if (messages == 0) {
+    printf("chatbench: no messages\n");
+    return 1;
+  }
+  printf("chatbench: %lu messages in %.2f s, %.0f/s\n", messages,
+	 (last - first) / 1e9, messages / ((last - first) / 1e9 + 1e-9));
+  stats_print(stdout);
+  printf("  cpu: network thread %.0f%%, render%s thread%s %.0f%%\n",
+	 thread / 1e7 / secs, logging ? " and log" : "", logging ? "s" : "",
+	 (cpu - thread) / 1e7 / secs);
+  if (logging)
+    printf("  log: %lu messages dropped\n", chatlog.dropped);
+  return 0;
+}
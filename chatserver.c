@@ -0,0 +1,212 @@
+/*
+ * A stand-in for the chat server, for trying the client out offline
+ *
+ * Usage: chatserver [[host]:port]
+ *
+ * Every newline-terminated message a client sends is passed on to all
+ * connected clients, the sender included.  Listens on 127.0.0.1:42000
+ * unless told otherwise.  A client that cannot keep up does not hold
+ * the others back: once its queue is full, messages to it are dropped
+ * and counted.  SIGINT or SIGTERM prints the totals and stops.
+ */
+#include "eventloop.h"
+#include "framer.h"
+#include "sendq.h"
+#include "conn.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+
+#define SERVER_PORT 42000
+
+struct client {
+  int fd;
+  int queued;              /* Anything pushed since the last flush? */
+  int failed;              /* Hang up once it is safe to */
+  unsigned long dropped;   /* Messages it was too slow to be sent */
+  struct framer framer;
+  struct sendq outq;
+};
+
+static struct client *clients[EVLOOP_MAXFD]; /* The first nclients */
+static int nclients;
+static unsigned long received, sent, dropped;
+
+/* A message that wraps around the framer's ring is put back together */
+static char message[FRAMER_SIZE];
+
+/* Let go of client i, moving the last one into its place */
+static void hangup(int i)
+{
+  struct client *c = clients[i];
+
+  fprintf(stderr, "Client %d left, %lu messages dropped\n", c->fd,
+	  c->dropped);
+  evloop_del(c->fd);
+  close(c->fd);
+  clients[i] = clients[--nclients];
+  free(c);
+}
+
+/*
+ * Write what c's socket will take.  Returns -1 if the write failed,
+ * after which c is only good for hanging up.
+ */
+static int flush(struct client *c)
+{
+  c->queued = 0;
+  switch (sendq_flush(&c->outq, c->fd)) {
+  case 0:
+    evloop_mod(c->fd, EPOLLIN);
+    return 0;
+  case 1:
+    evloop_mod(c->fd, EPOLLIN | EPOLLOUT);
+    return 0;
+  default:
+    c->failed = 1;
+    return -1;
+  }
+}
+
+/* Send what was queued by the messages just read, and drop the clients
+   that have failed */
+static void flushall(void)
+{
+  int i;
+
+  for (i = nclients - 1 ; i >= 0 ; i--) {
+    if (clients[i]->queued) flush(clients[i]);
+    if (clients[i]->failed) hangup(i);
+  }
+}
+
+/* Queue a message for every client, making room by flushing if needed */
+static void broadcast(const char *a, int alen, const char *b, int blen,
+		      void *ignored)
+{
+  const char *s = a;
+  int i, n = alen + blen;
+  struct client *c;
+
+  if (blen > 0) {
+    memcpy(message, a, alen);
+    memcpy(message + alen, b, blen);
+    s = message;
+  }
+  received++;
+
+  for (i = 0 ; i < nclients ; i++) {
+    c = clients[i];
+    if (c->failed) continue;
+    if (sendq_push(&c->outq, s, n) < 0 &&
+	(flush(c) < 0 || sendq_push(&c->outq, s, n) < 0)) {
+      c->dropped++;
+      dropped++;
+      continue;
+    }
+    c->queued = 1;
+    sent++;
+  }
+}
+
+static void client_f(int fd, uint32_t events, void *arg)
+{
+  struct client *c = arg;
+  int n;
+
+  if (events & EPOLLOUT) flush(c);
+  if (!c->failed && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+    n = framer_read(&c->framer, fd, broadcast, NULL);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+      c->failed = 1;
+  }
+  flushall();
+}
+
+static void accept_f(int listener, uint32_t events, void *ignored)
+{
+  struct client *c;
+  int fd;
+
+  while ( (fd = accept(listener, NULL, NULL)) >= 0 ) {
+    if (fd >= EVLOOP_MAXFD || fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+	(c = malloc(sizeof(*c))) == NULL) {
+      fprintf(stderr, "Turning a client away\n");
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->queued = 0;
+    c->failed = 0;
+    c->dropped = 0;
+    framer_init(&c->framer);
+    sendq_init(&c->outq);
+    if (evloop_add(fd, EPOLLIN, client_f, c) < 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    clients[nclients++] = c;
+  }
+}
+
+static void signal_f(int fd, uint32_t events, void *ignored)
+{
+  struct signalfd_siginfo info;
+
+  if (read(fd, &info, sizeof(info)) == sizeof(info))
+    evloop_stop();
+}
+
+int main(int argc, char *argv[])
+{
+  struct sockaddr_in addr;
+  sigset_t signals;
+  int listener, one = 1;
+
+  if ( conn_resolve(&addr, argc > 1 ? argv[1] : "127.0.0.1", SERVER_PORT) ) {
+    fprintf(stderr, "Error: Could not find \"%s\"\n", argv[1]);
+    exit(1);
+  }
+
+  /* A write to a client that has gone should fail, not kill us */
+  signal(SIGPIPE, SIG_IGN);
+
+  if ( evloop_init() < 0 ) {
+    fprintf(stderr, "Error: Could not create the event loop\n");
+    exit(1);
+  }
+  if ( (listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ) {
+    perror("Error: Could not create socket");
+    exit(1);
+  }
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ( bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+       listen(listener, 128) < 0 ) {
+    perror("Error: Could not listen");
+    exit(1);
+  }
+  if ( evloop_add(listener, EPOLLIN, accept_f, NULL) < 0 ) {
+    fprintf(stderr, "Error: Could not watch for clients\n");
+    exit(1);
+  }
+
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  if ( evloop_signals(&signals, signal_f, NULL) < 0 ) {
+    fprintf(stderr, "Error: Could not watch for signals\n");
+    exit(1);
+  }
+
+  evloop_run();
+
+  printf("chatserver: %lu messages in, %lu out, %lu dropped, "
+	 "%d clients still on\n", received, sent, dropped, nclients);
+  return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * The connection to the chat server
+ */
+#include "conn.h"
+#include "eventloop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+static void attempt(struct conn *);
+static void conn_f(int, uint32_t, void *);
+
+static void retry_f(int fd, uint32_t events, void *arg)
+{
+  attempt(arg);
+}
+
+/*
+ * Give up on the socket, if any, and try again after the backoff
+ */
+static void drop(struct conn *c, const char *why)
+{
+  if (c->fd >= 0) {
+    fprintf(stderr, "%s: %s\n", why, strerror(errno));
+    if (c->state == CONN_ONLINE)
+      framer_flush(&c->framer, c->message, c->arg);
+    evloop_del(c->fd);
+    close(c->fd);
+    c->fd = -1;
+  }
+  c->state = CONN_OFFLINE;
+  c->retry = c->backoff / 2 + rand() % (c->backoff / 2 + 1);
+  c->backoff = c->backoff * 2 < CONN_MAX_BACKOFF ?
+    c->backoff * 2 : CONN_MAX_BACKOFF;
+  evloop_arm(c->timer, c->retry, 0);
+  c->status(c, c->arg);
+}
+
+/*
+ * Write whatever the socket will take of the queued messages, and
+ * watch for it becoming writable only while some are left over
+ */
+static void flush(struct conn *c)
+{
+  switch (sendq_flush(&c->outq, c->fd)) {
+  case 0:
+    evloop_mod(c->fd, EPOLLIN);
+    break;
+  case 1:
+    evloop_mod(c->fd, EPOLLIN | EPOLLOUT);
+    break;
+  default:
+    drop(c, "Send failed");
+    break;
+  }
+}
+
+/* The socket is connected: start afresh and send anything held back */
+static void online(struct conn *c)
+{
+  c->state = CONN_ONLINE;
+  c->backoff = CONN_MIN_BACKOFF;
+  framer_init(&c->framer);
+  sendq_rewind(&c->outq);
+  c->status(c, c->arg);
+  flush(c);
+}
+
+static void attempt(struct conn *c)
+{
+  int one = 1;
+
+  if ( (c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ) {
+    perror("Could not create socket");
+    drop(c, NULL);
+    return;
+  }
+  /* Send each message straight away */
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  c->state = CONN_CONNECTING;
+  if ( evloop_add(c->fd, EPOLLOUT, conn_f, c) < 0 ) {
+    drop(c, "Could not watch the socket");
+    return;
+  }
+  if ( connect(c->fd, (struct sockaddr *) &c->addr, sizeof(c->addr)) == 0 )
+    online(c);
+  else if (errno == EINPROGRESS)
+    c->status(c, c->arg);
+  else
+    drop(c, "Could not connect");
+}
+
+static void conn_f(int fd, uint32_t events, void *arg)
+{
+  struct conn *c = arg;
+  socklen_t len = sizeof(int);
+  int n, err;
+
+  if (c->state == CONN_CONNECTING) {
+    /* The connect() finished, one way or the other */
+    if ( getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 )
+      drop(c, "Could not connect");
+    else if (err) {
+      errno = err;
+      drop(c, "Could not connect");
+    } else
+      online(c);
+    return;
+  }
+
+  if (events & EPOLLOUT)
+    flush(c);
+  if (c->fd >= 0 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+    c->readat = stats_now();
+    n = framer_read(&c->framer, fd, c->message, c->arg);
+    if (n == 0) {
+      errno = ECONNRESET;
+      drop(c, "Server went away");
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR)
+      drop(c, "Receive failed");
+  }
+}
+
+/*
+ * Start connecting to the server at addr.  message is called for each
+ * message received and status each time the state changes, both with
+ * arg.  Returns 0, or -1 if the retry timer could not be created.
+ */
+int conn_init(struct conn *c, const struct sockaddr_in *addr,
+	      framer_fn message, conn_fn status, void *arg)
+{
+  c->fd = -1;
+  c->addr = *addr;
+  c->backoff = CONN_MIN_BACKOFF;
+  c->retry = 0;
+  c->message = message;
+  c->status = status;
+  c->arg = arg;
+  sendq_init(&c->outq);
+  if ( (c->timer = evloop_timer(retry_f, c)) < 0 )
+    return -1;
+  attempt(c);
+  return 0;
+}
+
+/*
+ * Queue a message, and send it now if online.  Returns -1 if the queue
+ * is full.
+ */
+int conn_send(struct conn *c, const char *s, int n)
+{
+  if (sendq_push(&c->outq, s, n) < 0)
+    return -1;
+  if (c->state == CONN_ONLINE)
+    flush(c);
+  return 0;
+}
+
+/* Messages not yet sent */
+int conn_queued(struct conn *c)
+{
+  return c->outq.msgtail - c->outq.msghead;
+}
+
+/*
+ * Close the connection for good: a retry that was waiting is dropped
+ * along with its timer
+ */
+void conn_close(struct conn *c)
+{
+  if (c->fd >= 0) {
+    evloop_del(c->fd);
+    close(c->fd);
+    c->fd = -1;
+  }
+  if (c->timer >= 0) {
+    evloop_arm(c->timer, 0, 0);
+    evloop_del(c->timer);
+    close(c->timer);
+    c->timer = -1;
+  }
+  c->state = CONN_OFFLINE;
+}
+
+/*
+ * Fill in addr from spec, "host", "host:port" or ":port", the host
+ * being a name or an IPv4 address and the port defaulting to port.
+ * Returns 0, or -1 if the host could not be found.
+ */
+int conn_resolve(struct sockaddr_in *addr, const char *spec, int port)
+{
+  char host[256];
+  const char *colon = strrchr(spec, ':');
+  struct addrinfo hints, *res;
+  int n = colon != NULL ? colon - spec : (int) strlen(spec);
+
+  if (n >= (int) sizeof(host)) return -1;
+  memcpy(host, spec, n);
+  host[n] = 0;
+  if (colon != NULL && (port = atoi(colon + 1)) <= 0) return -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(n > 0 ? host : "127.0.0.1", NULL, &hints, &res) != 0)
+    return -1;
+  memcpy(addr, res->ai_addr, sizeof(*addr));
+  addr->sin_port = htons(port);
+  freeaddrinfo(res);
+  return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef _CONN_H
+#define _CONN_H
+
+#include <netinet/in.h>
+#include "framer.h"
+#include "sendq.h"
+#include "stats.h"
+
+#define CONN_MIN_BACKOFF 250    /* ms before the first retry */
+#define CONN_MAX_BACKOFF 30000  /* ms between retries, at most */
+
+#define CONN_OFFLINE 0     /* Waiting to try again */
+#define CONN_CONNECTING 1  /* connect() in progress */
+#define CONN_ONLINE 2
+
+struct conn;
+
+/* Called whenever the connection changes state */
+typedef void (*conn_fn)(struct conn *, void *);
+
+/*
+ * A connection to the chat server that comes back by itself.  After a
+ * failure, the next attempt waits a random time between half and all
+ * of the backoff, which doubles each time up to CONN_MAX_BACKOFF, so
+ * clients dropped together by a server restart do not all come back
+ * at the same moment.  Messages sent while offline are queued.
+ */
+struct conn {
+  int fd;                   /* Socket, or -1 while offline */
+  int state;                /* CONN_OFFLINE, CONN_CONNECTING or CONN_ONLINE */
+  struct sockaddr_in addr;  /* The server */
+  int timer;                /* Goes off when it is time to retry */
+  unsigned backoff;         /* Upper bound on the next wait, ms */
+  unsigned retry;           /* The wait chosen after the last failure, ms */
+  framer_fn message;        /* Called for each message received */
+  conn_fn status;
+  void *arg;
+  long long readat;         /* When the messages being handed out were read */
+  struct framer framer;
+  struct sendq outq;
+};
+
+extern int conn_init(struct conn *, const struct sockaddr_in *,
+		     framer_fn, conn_fn, void *);
+extern int conn_send(struct conn *, const char *, int);
+extern int conn_queued(struct conn *);
+extern void conn_close(struct conn *);
+extern int conn_resolve(struct sockaddr_in *, const char *, int);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * The entry line editor
+ *
+ * Every edit at the cursor is constant time.  Drawing compares each
+ * cell of the window with what it showed last time and only redraws
+ * the ones that differ.
+ */
+#include "editor.h"
+#include "render.h"
+#include "keymap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+ * Set up an empty editor drawn on rows row .. row + rows - 1.  Returns
+ * 0 on success, -1 if there is no memory for the window.
+ */
+int editor_init(struct editor *e, int row, int rows, int cols)
+{
+  e->row = row;
+  e->rows = rows;
+  e->cols = cols;
+  if ( (e->shown = malloc(rows * cols)) == NULL ) return -1;
+  memset(e->shown, 0, rows * cols); /* Matches nothing: draw every cell */
+  editor_clear(e);
+  return 0;
+}
+
+/* The character at position pos, which must be less than e->len */
+static char charat(const struct editor *e, int pos)
+{
+  return pos < e->gap ? e->buf[pos] : e->buf[pos + e->gapend - e->gap];
+}
+
+void editor_insert(struct editor *e, char c)
+{
+  if (e->gap == e->gapend) return; /* Full */
+  e->buf[e->gap++] = c;
+  e->len++;
+}
+
+/* Delete the character before the cursor */
+void editor_backspace(struct editor *e)
+{
+  if (e->gap == 0) return;
+  e->gap--;
+  e->len--;
+}
+
+/* Delete the character under the cursor */
+void editor_delete(struct editor *e)
+{
+  if (e->gapend == EDITOR_SIZE) return;
+  e->gapend++;
+  e->len--;
+}
+
+/*
+ * Move the cursor by n characters, left if n is negative, stopping at
+ * either end of the text
+ */
+void editor_move(struct editor *e, int n)
+{
+  if (n < -e->gap) n = -e->gap;
+  if (n > EDITOR_SIZE - e->gapend) n = EDITOR_SIZE - e->gapend;
+  if (n < 0) {
+    memmove(e->buf + e->gapend + n, e->buf + e->gap + n, -n);
+  } else {
+    memmove(e->buf + e->gap, e->buf + e->gapend, n);
+  }
+  e->gap += n;
+  e->gapend += n;
+}
+
+void editor_home(struct editor *e)
+{
+  editor_move(e, -e->gap);
+}
+
+void editor_end(struct editor *e)
+{
+  editor_move(e, EDITOR_SIZE - e->gapend);
+}
+
+/*
+ * Move to the start of the previous word (dir < 0) or the end of the
+ * next one (dir > 0)
+ */
+void editor_word(struct editor *e, int dir)
+{
+  int pos = e->gap;
+
+  if (dir < 0) {
+    while (pos > 0 && isspace((unsigned char) charat(e, pos - 1))) pos--;
+    while (pos > 0 && !isspace((unsigned char) charat(e, pos - 1))) pos--;
+  } else {
+    while (pos < e->len && isspace((unsigned char) charat(e, pos))) pos++;
+    while (pos < e->len && !isspace((unsigned char) charat(e, pos))) pos++;
+  }
+  editor_move(e, pos - e->gap);
+}
+
+/*
+ * Return the whole text, contiguous, and store its length in *len.
+ * This moves the cursor to the end; the pointer is good until the next
+ * edit.
+ */
+const char *editor_text(struct editor *e, int *len)
+{
+  editor_end(e);
+  *len = e->len;
+  return e->buf;
+}
+
+void editor_clear(struct editor *e)
+{
+  e->gap = e->len = e->scroll = 0;
+  e->gapend = EDITOR_SIZE;
+}
+
+/*
+ * Move about or edit the text according to a key from keymap_key().
+ * Returns 1 if the text changed, 0 if it did not (only the cursor
+ * moved, or there was nothing to delete or no room to type), -1 if
+ * the key is not an editing key.
+ */
+int editor_key(struct editor *e, int key)
+{
+  int len = e->len;
+
+  switch (key) {
+  case KEY_LEFT: editor_move(e, -1); return 0;
+  case KEY_RIGHT: editor_move(e, 1); return 0;
+  case KEY_CTRL | KEY_LEFT: editor_word(e, -1); return 0;
+  case KEY_CTRL | KEY_RIGHT: editor_word(e, 1); return 0;
+  case KEY_HOME: editor_home(e); return 0;
+  case KEY_END: editor_end(e); return 0;
+  case '\b': editor_backspace(e); break;
+  case KEY_DELETE: editor_delete(e); break;
+
+  default:
+    /* Printable Character */
+    if (key < ' ' || key > '~') return -1;
+    editor_insert(e, key);
+    break;
+  }
+  return e->len != len;
+}
+
+/*
+ * Handle a key typed into a message entry: Enter hands the text to
+ * send, and clears the entry if send took it; any other key goes to
+ * editor_key().  Returns as editor_key() does.
+ */
+int editor_enter(struct editor *e, int key, editor_send_fn send, void *arg)
+{
+  const char *text;
+  int len;
+
+  if (key != '\n') return editor_key(e, key);
+  text = editor_text(e, &len);
+  if (len == 0 || send(text, len, arg) < 0) return 0;
+  editor_clear(e);
+  return 1;
+}
+
+/*
+ * Forget what the cells show, so the next editor_draw() draws every
+ * one, e.g. after another editor has drawn over them
+ */
+void editor_refresh(struct editor *e)
+{
+  memset(e->shown, 0, e->rows * e->cols);
+}
+
+/*
+ * Redraw the cells that changed since the last call.  The window
+ * scrolls by half its width at a time when the cursor leaves it, so
+ * typing at the end of a long message rarely shifts every cell.
+ */
+void editor_draw(struct editor *e)
+{
+  int cells = e->rows * e->cols;
+  int i, pos;
+  char c;
+
+  if (e->gap < e->scroll) {
+    e->scroll = e->gap - cells / 2;
+    if (e->scroll < 0) e->scroll = 0;
+  } else if (e->gap >= e->scroll + cells) {
+    e->scroll = e->gap - cells / 2;
+  }
+
+  for (i = 0 ; i < cells ; i++) {
+    pos = e->scroll + i;
+    if (pos == e->gap) c = '_'; /* The cursor */
+    else if (pos < e->len) c = charat(e, pos);
+    else c = ' ';
+    if (e->shown[i] == c) continue;
+    e->shown[i] = c;
+    render_putchar(c, e->row + i / e->cols, i % e->cols);
+  }
+}
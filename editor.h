@@ -0,0 +1,41 @@
+#ifndef _EDITOR_H
+#define _EDITOR_H
+
+#define EDITOR_SIZE 1024  /* Longest message that can be typed */
+
+/*
+ * A line editor on a gap buffer: the text before the cursor is at the
+ * start of buf, the text after it at the end, and typing fills the gap
+ * between them.  It is shown in a window of rows x cols cells that
+ * scrolls sideways to keep the cursor in view.
+ */
+struct editor {
+  char buf[EDITOR_SIZE];
+  int gap;       /* Start of the gap: the cursor position */
+  int gapend;    /* End of the gap */
+  int len;       /* Characters in the buffer */
+  int scroll;    /* Position of the character in the first cell */
+  int row, rows, cols;
+  char *shown;   /* What each cell was last drawn with */
+};
+
+extern int editor_init(struct editor *, int, int, int);
+extern void editor_insert(struct editor *, char);
+extern void editor_backspace(struct editor *);
+extern void editor_delete(struct editor *);
+extern void editor_move(struct editor *, int);
+extern void editor_home(struct editor *);
+extern void editor_end(struct editor *);
+extern void editor_word(struct editor *, int);
+extern const char *editor_text(struct editor *, int *);
+extern void editor_clear(struct editor *);
+extern int editor_key(struct editor *, int);
+
+/* Called with the text when Enter is pressed; 0 if it was taken */
+typedef int (*editor_send_fn)(const char *, int, void *);
+
+extern int editor_enter(struct editor *, int, editor_send_fn, void *);
+extern void editor_draw(struct editor *);
+extern void editor_refresh(struct editor *);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * A single-threaded event loop on epoll.  Everything the client waits
+ * for (the socket, libusb's file descriptors, timers and signals) is a
+ * file descriptor watched here, and its callback runs on the one thread
+ * that calls evloop_run().
+ */
+#include "eventloop.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#define EVLOOP_BATCH 32  /* Events handled per epoll_wait() */
+
+struct watch {
+  evloop_fn fn;
+  void *arg;
+  int timer;  /* A timerfd, whose expiry count must be read */
+};
+
+static int epfd = -1;
+static struct watch watches[EVLOOP_MAXFD];
+static int running;
+
+/*
+ * Create the epoll instance.  Returns 0 on success, -1 on error.
+ */
+int evloop_init(void)
+{
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  return epfd < 0 ? -1 : 0;
+}
+
+/*
+ * Call fn whenever one of the given epoll events happens on fd.
+ * Returns 0 on success, -1 on error.
+ */
+int evloop_add(int fd, uint32_t events, evloop_fn fn, void *arg)
+{
+  struct epoll_event ev;
+
+  if (fd < 0 || fd >= EVLOOP_MAXFD) return -1;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) return -1;
+  watches[fd].fn = fn;
+  watches[fd].arg = arg;
+  watches[fd].timer = 0;
+  return 0;
+}
+
+/*
+ * Change the events watched on fd
+ */
+int evloop_mod(int fd, uint32_t events)
+{
+  struct epoll_event ev;
+
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/*
+ * Stop watching fd.  Events for it already collected by the loop are
+ * dropped.
+ */
+void evloop_del(int fd)
+{
+  if (fd < 0 || fd >= EVLOOP_MAXFD) return;
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+  watches[fd].fn = NULL;
+}
+
+/*
+ * Create a timer that calls fn when it expires.  It starts disarmed;
+ * see evloop_arm().  Returns the timer's file descriptor or -1.
+ */
+int evloop_timer(evloop_fn fn, void *arg)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (fd < 0) return -1;
+  if (evloop_add(fd, EPOLLIN, fn, arg) < 0) {
+    close(fd);
+    return -1;
+  }
+  watches[fd].timer = 1;
+  return fd;
+}
+
+/*
+ * Make timer fd expire in ms milliseconds and then every interval
+ * milliseconds (or just once if interval is 0).  An ms of 0 disarms it.
+ */
+void evloop_arm(int fd, unsigned ms, unsigned interval)
+{
+  struct itimerspec its;
+
+  its.it_value.tv_sec = ms / 1000;
+  its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+  its.it_interval.tv_sec = interval / 1000;
+  its.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+  timerfd_settime(fd, 0, &its, NULL);
+}
+
+/*
+ * Deliver the given signals through the loop instead of as
+ * asynchronous handlers.  fn must read the struct signalfd_siginfo
+ * from the file descriptor it is passed.  Returns the descriptor or -1.
+ */
+int evloop_signals(const sigset_t *set, evloop_fn fn, void *arg)
+{
+  int fd;
+
+  if (sigprocmask(SIG_BLOCK, set, NULL) < 0) return -1;
+  if ((fd = signalfd(-1, set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) return -1;
+  if (evloop_add(fd, EPOLLIN, fn, arg) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Dispatch events until evloop_stop() is called.  Sleeps in
+ * epoll_wait() whenever there is nothing to do.
+ */
+void evloop_run(void)
+{
+  struct epoll_event events[EVLOOP_BATCH];
+  struct watch *w;
+  uint64_t expirations;
+  int i, n, fd;
+
+  running = 1;
+  while (running) {
+    if ((n = epoll_wait(epfd, events, EVLOOP_BATCH, -1)) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    for (i = 0 ; i < n && running ; i++) {
+      fd = events[i].data.fd;
+      w = &watches[fd];
+      if (w->fn == NULL) continue; /* Removed by an earlier callback */
+      if (w->timer && read(fd, &expirations, sizeof(expirations)) < 0)
+	continue;
+      w->fn(fd, events[i].events, w->arg);
+    }
+  }
+}
+
+/*
+ * Make evloop_run() return once the current callback finishes
+ */
+void evloop_stop(void)
+{
+  running = 0;
+}
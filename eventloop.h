@@ -0,0 +1,23 @@
+#ifndef _EVENTLOOP_H
+#define _EVENTLOOP_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#define EVLOOP_MAXFD 1024  /* File descriptors must be below this */
+
+/* Called with the file descriptor and the epoll events that fired */
+typedef void (*evloop_fn)(int, uint32_t, void *);
+
+extern int evloop_init(void);
+extern int evloop_add(int, uint32_t, evloop_fn, void *);
+extern int evloop_mod(int, uint32_t);
+extern void evloop_del(int);
+extern int evloop_timer(evloop_fn, void *);
+extern void evloop_arm(int, unsigned, unsigned);
+extern int evloop_signals(const sigset_t *, evloop_fn, void *);
+extern void evloop_run(void);
+extern void evloop_stop(void);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Rendering benchmarks, run on a memory surface unless FBSURFACE names
+ * another (see fbsurface.h), at the scale given by FBSCALE, with the
+ * PSF2 font FBFONT if set
+ *
+ * Usage: fbbench [frame.ppm]
+ *
+ * Saves the last frame drawn to frame.ppm if given.
+ */
+#include "fbputchar.h"
+#include "fbkernel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SCREENS 200     /* Full screens of glyphs drawn */
+#define MESSAGES 20000  /* One-line messages received */
+#define CLEARS 1000
+
+/* Two-byte Latin, three-byte symbols and CJK, and a four-byte emoji */
+static const char utf8text[] = "caf\xc3\xa9 na\xc3\xafve \xe2\x9c\x93 "
+  "\xe2\x82\xac \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80 ";
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Fill the screen with text, with an x at xrow, xcol */
+static void fillscreen(int rows, int cols, int xrow, int xcol)
+{
+  int row, col;
+
+  for (row = 0 ; row < rows ; row++)
+    for (col = 0 ; col < cols ; col++)
+      fbputchar(row == xrow && col == xcol ? 'x' : ' ' + (row + col) % 95,
+		row, col);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *spec = getenv("FBSURFACE");
+  const char *font = getenv("FBFONT");
+  char *line, *utf8line;
+  double start, secs;
+  int err, i, n, row, col, cols, rows, freeRow = 0;
+  static const char *kernels[] = { "cache", "scalar", "sse2", "avx2" };
+  unsigned k;
+  int scale = getenv("FBSCALE") ? atoi(getenv("FBSCALE")) : FB_DEFAULTSCALE;
+
+  if (font != NULL && fbsetfont(font) != 0) {
+    fprintf(stderr, "Error: Could not load the font %s\n", font);
+    exit(1);
+  }
+  if ( (err = fbopen_surface(spec != NULL ? spec : "mem", scale)) != 0 ) {
+    fprintf(stderr, "Error: Could not open surface: %d\n", err);
+    exit(1);
+  }
+  fbclear();
+  fbflush();
+  cols = fbcols();
+  rows = fbrows();
+  line = malloc(cols + 1);
+  utf8line = malloc(4 * cols + 1);
+
+  /* Every cell of the screen, then a flush, as when a page is drawn,
+     with each set of kernels; the best is used for the rest */
+  for (k = 0 ; k < sizeof(kernels) / sizeof(kernels[0]) ; k++) {
+    if (fbkernel_select(kernels[k]) < 0) continue;
+    start = now();
+    for (i = 0 ; i < SCREENS ; i++) {
+      for (row = 0 ; row < rows ; row++)
+	for (col = 0 ; col < cols ; col++)
+	  fbputchar(' ' + (i + row + col) % 95, row, col);
+      fbflush();
+    }
+    secs = now() - start;
+    printf("fbputchar %-6s%12.0f glyphs/s\n", kernels[k],
+	   SCREENS * rows * cols / secs);
+  }
+  fbkernel_init(scale);
+
+  /* Full-width messages, each flushed, so the receive rows scroll */
+  for (col = 0 ; col < cols ; col++)
+    line[col] = 'a' + col % 26;
+  line[cols] = 0;
+  start = now();
+  for (i = 0 ; i < MESSAGES ; i++) {
+    line[i % cols] = '0' + i % 10;
+    print_to_screen(line, &freeRow, cols);
+    fbflush();
+  }
+  secs = now() - start;
+  printf("print_to_screen %12.0f rows/s\n", MESSAGES / secs);
+
+  /* The same in UTF-8, about one character in three not ASCII, to
+     compare the cost of decoding and of glyphs outside the first 128 */
+  for (n = 0, i = 0, col = 0 ; col < cols ; col++)
+    do
+      utf8line[n++] = utf8text[i++ % (sizeof(utf8text) - 1)];
+    while ((utf8text[i % (sizeof(utf8text) - 1)] & 0xc0) == 0x80);
+  start = now();
+  for (i = 0 ; i < MESSAGES ; i++) {
+    utf8line[0] = '0' + i % 10;
+    print_to_screen(utf8line, &freeRow, n);
+    fbflush();
+  }
+  secs = now() - start;
+  printf("print_to_screen %12.0f rows/s UTF-8\n", MESSAGES / secs);
+
+  /* A screen of text drawn again with one character moved, as an edit
+     redraws its rows: only the two cells that change should cost much */
+  start = now();
+  for (i = 0 ; i < CLEARS ; i++) {
+    fillscreen(rows, cols, i % rows, i % cols);
+    fbflush();
+  }
+  secs = now() - start;
+  printf("redraw          %12.1f us one cell changed\n", secs / CLEARS * 1e6);
+
+  /* A screen of text cleared, which does have to draw every cell */
+  for (secs = 0, i = 0 ; i < CLEARS ; i++) {
+    fillscreen(rows, cols, -1, -1);
+    fbflush();
+    start = now();
+    fbclear();
+    fbflush();
+    secs += now() - start;
+  }
+  printf("fbclear         %12.1f us\n", secs / CLEARS * 1e6);
+
+  if (argc > 1) {
+    fbputs("fbbench", 0, 0);
+    fbflush();
+    if (fbdump(argv[1]) < 0) {
+      fprintf(stderr, "Error: Could not write %s\n", argv[1]);
+      exit(1);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Pixel kernels: glyph expansion and framebuffer copies
+ *
+ * On x86 there are SSE2 and AVX2 versions, compiled with target
+ * attributes so the rest of the program needs no special flags, and
+ * picked at run time from what the CPU supports.  Expansion broadcasts
+ * a row of font bits to every lane, ANDs it with the bit each pixel
+ * shows and blends fg and bg with the result.  The copy to the
+ * framebuffer uses non-temporal stores, so a repaint does not push
+ * everything else out of the cache; the framebuffer is never read back.
+ */
+#include "fbkernel.h"
+#include "fbputchar.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FBKERNEL_X86
+#endif
+
+fbkernel_expand_fn fbkernel_expand;
+static int scale = 1;
+fbkernel_copy_fn fbkernel_copy = memcpy;
+const char *fbkernel_name = "cache";
+
+/* For each scale, the font bit each pixel of a row shows */
+static uint32_t masks[FB_MAXSCALE][8 * FB_MAXSCALE]
+  __attribute__((aligned(32)));
+
+/*
+ * Each kernel is generated for every scale S, so the number of vectors
+ * per row and the number of times each is stored are constants the
+ * compiler can unroll.
+ */
+#define EXPAND_SCALAR(S) \
+static void expand_scalar##S(unsigned char *dst, int pitch, \
+			     const unsigned char *rows, int height, \
+			     uint32_t fg, uint32_t bg) \
+{ \
+  const uint32_t *m = masks[S - 1]; \
+  uint32_t *p; \
+  int y, x, i; \
+ \
+  for (y = 0 ; y < height ; y++, dst += S * pitch) { \
+    p = (uint32_t *) dst; \
+    for (x = 0 ; x < 8 * S ; x++) \
+      p[x] = rows[y] & m[x] ? fg : bg; \
+    for (i = 1 ; i < S ; i++) \
+      memcpy(dst + i * pitch, dst, 8 * S * 4); \
+  } \
+}
+EXPAND_SCALAR(1)
+EXPAND_SCALAR(2)
+EXPAND_SCALAR(3)
+EXPAND_SCALAR(4)
+
+static const fbkernel_expand_fn scalar[FB_MAXSCALE] = {
+  expand_scalar1, expand_scalar2, expand_scalar3, expand_scalar4
+};
+
+#ifdef FBKERNEL_X86
+
+/* 4 pixels at a time */
+#define EXPAND_SSE2(S) \
+__attribute__((target("sse2"))) \
+static void expand_sse2_##S(unsigned char *dst, int pitch, \
+			    const unsigned char *rows, int height, \
+			    uint32_t fg, uint32_t bg) \
+{ \
+  const __m128i *m = (const __m128i *) masks[S - 1]; \
+  __m128i vfg = _mm_set1_epi32(fg), vbg = _mm_set1_epi32(bg); \
+  __m128i bits, on, px; \
+  int y, v, i; \
+ \
+  for (y = 0 ; y < height ; y++, dst += S * pitch) { \
+    bits = _mm_set1_epi32(rows[y]); \
+    for (v = 0 ; v < 2 * S ; v++) { \
+      on = _mm_cmpeq_epi32(_mm_and_si128(bits, m[v]), m[v]); \
+      px = _mm_or_si128(_mm_and_si128(on, vfg), _mm_andnot_si128(on, vbg)); \
+      for (i = 0 ; i < S ; i++) \
+	_mm_storeu_si128((__m128i *) (dst + i * pitch) + v, px); \
+    } \
+  } \
+}
+EXPAND_SSE2(1)
+EXPAND_SSE2(2)
+EXPAND_SSE2(3)
+EXPAND_SSE2(4)
+
+static const fbkernel_expand_fn sse2[FB_MAXSCALE] = {
+  expand_sse2_1, expand_sse2_2, expand_sse2_3, expand_sse2_4
+};
+
+/* 8 pixels at a time; at scale 1 a row is a single vector */
+#define EXPAND_AVX2(S) \
+__attribute__((target("avx2"))) \
+static void expand_avx2_##S(unsigned char *dst, int pitch, \
+			    const unsigned char *rows, int height, \
+			    uint32_t fg, uint32_t bg) \
+{ \
+  const __m256i *m = (const __m256i *) masks[S - 1]; \
+  __m256i vfg = _mm256_set1_epi32(fg), vbg = _mm256_set1_epi32(bg); \
+  __m256i bits, on, px; \
+  int y, v, i; \
+ \
+  for (y = 0 ; y < height ; y++, dst += S * pitch) { \
+    bits = _mm256_set1_epi32(rows[y]); \
+    for (v = 0 ; v < S ; v++) { \
+      on = _mm256_cmpeq_epi32(_mm256_and_si256(bits, m[v]), m[v]); \
+      px = _mm256_blendv_epi8(vbg, vfg, on); \
+      for (i = 0 ; i < S ; i++) \
+	_mm256_storeu_si256((__m256i *) (dst + i * pitch) + v, px); \
+    } \
+  } \
+}
+EXPAND_AVX2(1)
+EXPAND_AVX2(2)
+EXPAND_AVX2(3)
+EXPAND_AVX2(4)
+
+static const fbkernel_expand_fn avx2[FB_MAXSCALE] = {
+  expand_avx2_1, expand_avx2_2, expand_avx2_3, expand_avx2_4
+};
+
+/*
+ * Copy with 16-byte non-temporal stores, after bringing dst up to a
+ * 16-byte boundary.  fbkernel_fence() must follow before the result is
+ * shown.
+ */
+__attribute__((target("sse2")))
+static void *copy_stream(void *dst, const void *src, size_t n)
+{
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  size_t head = -(uintptr_t) d & 15;
+
+  if (n < 64 || head > n) return memcpy(dst, src, n);
+  memcpy(d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+  for ( ; n >= 64 ; n -= 64, d += 64, s += 64) {
+    _mm_stream_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+    _mm_stream_si128((__m128i *) d + 1,
+		     _mm_loadu_si128((const __m128i *) s + 1));
+    _mm_stream_si128((__m128i *) d + 2,
+		     _mm_loadu_si128((const __m128i *) s + 2));
+    _mm_stream_si128((__m128i *) d + 3,
+		     _mm_loadu_si128((const __m128i *) s + 3));
+  }
+  memcpy(d, s, n);
+  return dst;
+}
+
+#endif
+
+/* Select kernels by name: "cache", "scalar", "sse2" or "avx2".  Returns
+   -1 if the CPU cannot run them. */
+int fbkernel_select(const char *name)
+{
+  if (strcmp(name, "cache") == 0) {
+    fbkernel_expand = NULL;
+    fbkernel_copy = memcpy;
+  } else if (strcmp(name, "scalar") == 0) {
+    fbkernel_expand = scalar[scale - 1];
+    fbkernel_copy = memcpy;
+#ifdef FBKERNEL_X86
+  } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    fbkernel_expand = sse2[scale - 1];
+    fbkernel_copy = copy_stream;
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    fbkernel_expand = avx2[scale - 1];
+    fbkernel_copy = copy_stream;
+#endif
+  } else
+    return -1;
+  fbkernel_name = name;
+  return 0;
+}
+
+/* Fill in the masks and pick the best kernels this CPU can run for
+   the given font scale */
+void fbkernel_init(int fontscale)
+{
+  int s, x;
+
+  scale = fontscale;
+  for (s = 1 ; s <= FB_MAXSCALE ; s++)
+    for (x = 0 ; x < 8 * s ; x++)
+      masks[s - 1][x] = 0x80 >> (x / s);
+
+#ifdef FBKERNEL_X86
+  __builtin_cpu_init();
+  if (fbkernel_select("avx2") == 0 || fbkernel_select("sse2") == 0)
+    return;
+#endif
+  fbkernel_select("scalar");
+}
+
+/* Make the non-temporal stores so far visible, e.g. before a pan */
+void fbkernel_fence(void)
+{
+#ifdef FBKERNEL_X86
+  if (fbkernel_copy == copy_stream) _mm_sfence();
+#endif
+}
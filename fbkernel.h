@@ -0,0 +1,33 @@
+#ifndef _FBKERNEL_H
+#define _FBKERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Expand height rows of a 1-bit font, one byte per row, into 32-bit
+ * pixels at dst: each bit becomes scale pixels of fg (set) or bg (clear)
+ * across and each row is repeated scale times down, pitch bytes apart.
+ * The scale is the one given to fbkernel_init().
+ */
+typedef void (*fbkernel_expand_fn)(unsigned char *dst, int pitch,
+				   const unsigned char *rows, int height,
+				   uint32_t fg, uint32_t bg);
+
+/* Copy n bytes to the framebuffer, bypassing the cache if possible */
+typedef void *(*fbkernel_copy_fn)(void *dst, const void *src, size_t n);
+
+/*
+ * The kernels in use, picked by fbkernel_init() for this CPU.  expand is
+ * NULL when the "cache" kernels are selected: fbputchar then copies
+ * pre-rendered glyphs instead.
+ */
+extern fbkernel_expand_fn fbkernel_expand;
+extern fbkernel_copy_fn fbkernel_copy;
+extern const char *fbkernel_name;
+
+extern void fbkernel_init(int);
+extern int fbkernel_select(const char *);
+extern void fbkernel_fence(void);
+
+#endif
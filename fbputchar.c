@@ -1,7 +1,43 @@
 /*
  * fbputchar: Framebuffer character generator
  *
- * Assumes 32bpp
+ * Works in 16bpp (RGB565), 24bpp and 32bpp.  At 32bpp, glyphs are
+ * expanded straight from the font by the fastest kernel the CPU has
+ * (see fbkernel.c); otherwise they are copied from a cache of
+ * pre-rendered glyphs.  The font is the built-in one, which covers
+ * ASCII, or a PSF2 font loaded with fbsetfont(); characters are
+ * Unicode codepoints, looked up in the font's index (see psf.c), and
+ * received text is decoded from UTF-8.  The text grid is as many
+ * characters as fit on the screen at the chosen scale; the bottom three
+ * rows are the separator and the entry, and the rest show the
+ * scrollback, or the scrollbacks of several panes (see fbpanes()).
+ *
+ * Drawing only changes a grid of cells, the character and attributes
+ * each text cell should show.  fbflush() compares it, two cells to a
+ * 64-bit word, with a shadow of what each cell showed when it was last
+ * drawn, draws only the cells that differ into a back buffer in system
+ * memory, and copies the damaged parts of that to the device.  So
+ * redrawing a row that is mostly unchanged, or clearing text that is
+ * redrawn before the flush, costs only the cells that really change.
+ * When the virtual screen is at least twice as tall as the visible
+ * one, the copy goes to the hidden page and FBIOPAN_DISPLAY flips to
+ * it.
+ *
+ * The "framebuffer" may also be memory or a file standing in for the
+ * device (see fbsurface.h), so that drawing can be measured and the
+ * result looked at without a display.
+ *
+ * Received text only goes into the scrollback as it arrives; the
+ * receive rows are brought up to date once per flush, so a flood of
+ * messages costs one repaint of the final window per frame, whatever
+ * the states in between.  Lines older than the scrollback can be
+ * brought back from elsewhere (see fbscrollback()) when paging reaches
+ * the oldest one.  While searching, the receive rows show the messages
+ * found instead, with the text searched for in inverse video.
+ *
+ * Scrolling is a single memmove of the back buffer.  If the virtual
+ * screen has room below the page(s), the pages are also moved down by
+ * panning, so the framebuffer only needs the rows that did not scroll.
  *
  * References:
  *
@@ -12,28 +48,158 @@
  */
 #include <stdio.h>
 #include "fbputchar.h"
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/ioctl.h>
+#include "history.h"
+#include "fbsurface.h"
+#include "fbkernel.h"
+#include "psf.h"
+#include "utf8.h"
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 
-#include <linux/fb.h>
+#define FONT_WIDTH 8      /* Every font, built in or loaded */
+#define FONT_HEIGHT 16    /* The built-in font */
+#define FONT_GLYPHS 128
+#define FONT_MAXHEIGHT 64
 
-#define FBDEV "/dev/fb0"
+#define GLYPH_SLOTS 256   /* Glyphs in the pre-rendered cache */
+#define RECEIVE_CHUNK 256 /* Bytes decoded at a time */
+#define HIGHLIGHT_MAX 1024 /* Longest search text highlighted */
 
-#define FONT_WIDTH 8
-#define FONT_HEIGHT 16
-#define BITS_PER_PIXEL 32
+/* Damage rectangles remembered per page before they are merged */
+#define FB_MAXDAMAGE 16
 
-struct fb_var_screeninfo fb_vinfo;
-struct fb_fix_screeninfo fb_finfo;
-unsigned char *framebuffer;
+static struct fbsurface surface;
 static unsigned char font[];
-int unshift = 0;
-int lastKey = -1;
-int shiftOn = 0;
+static struct psf fontface;  /* The font in use */
+static int fontheight;
+static int fallback;         /* Glyph for characters the font lacks */
+
+static int bytespp;          /* Bytes per pixel */
+static int glyphwidth;       /* Pixels across one character: the font scaled */
+static int glyphheight;
+static int glyphrowbytes;    /* Bytes in one row of a character */
+static int textcols, textrows;
+static int fontscale;
+static uint32_t fgpixel, bgpixel; /* Text colours, in the surface's format */
+
+/* A rectangle of pixels, relative to the top left of the screen */
+struct fbrect {
+  int x, y, w, h;
+};
+
+/*
+ * A screen-sized region of framebuffer memory, and the parts of the
+ * back buffer that have changed since it was last brought up to date.
+ */
+struct fbpage {
+  int yoffset;
+  int ndamage;
+  struct fbrect damage[FB_MAXDAMAGE];
+};
+
+/*
+ * A cell is FBCELL_BLANK, or a codepoint, with FBCELL_INVERSE for the
+ * foreground and background swapped.  Rows of cells are cellpitch
+ * apart, an even number, so each row is whole 64-bit words.
+ */
+#define FBCELL_BLANK 0
+#define FBCELL_INVERSE 0x80000000u
+#define FBCELL_STALE 0xffffffffu   /* In the shadow: differs from any cell */
+
+static uint32_t *cells;           /* What each cell should show */
+static uint32_t *shadow;          /* What it showed when last drawn */
+static int cellpitch;
+static unsigned char *rowchanged; /* Cells written since the last flush? */
+
+static unsigned char *backbuffer; /* The cells as last drawn */
+static int backpitch;             /* Bytes per line of backbuffer */
+static struct fbpage pages[2];
+static int npages;                /* 2 when page flipping, else 1 */
+static int shown;                 /* Index of the page being displayed */
+static int canpan;                /* Does FBIOPAN_DISPLAY work? */
+static int changed;               /* Anything drawn since the last flush? */
+static int waitvsync;             /* Flush during the vertical blank? */
+static pthread_mutex_t fblock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * All but the bottom three rows show the scrollback, split into panes
+ * one above the other when there is more than one.  Each pane has its
+ * own scrollback and decoder, and a title row above its text.
+ */
+#define NOLINE ((unsigned long) -1)
+#define STALE ((unsigned long) -2) /* Row must be redrawn whatever it holds */
+
+struct pane {
+  int top, rows;                 /* The text rows */
+  struct history scrollback;
+  struct history *view;          /* What the rows show */
+  unsigned long viewtop;         /* Line shown on the first row */
+  unsigned long wanttop;         /* Line for the first row, if not following */
+  int following;                 /* Showing the newest page? */
+  int dirty;                     /* Rows behind the scrollback? */
+  unsigned long *shownline;      /* Line on each row */
+  struct utf8 received;          /* Decoding the message */
+};
+
+static struct pane panes[FB_MAXPANES];
+static int npanes;               /* Panes shown */
+static int madepanes;            /* Panes with a scrollback */
+static int receiverows;
+static unsigned long *shownline; /* Line on each screen row */
+static struct history found;     /* Messages found by a search */
+static uint32_t highlight[HIGHLIGHT_MAX + 2]; /* Inverted in what is found */
+static int highlightlen;
+static fbolder_fn older;         /* Brings back older lines */
+static pthread_mutex_t receivelock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Glyphs pre-rendered in the framebuffer's pixel layout, one
+ * horizontally scaled row of glyphrowbytes per font row.  Each row is
+ * drawn scale times to get the vertical scaling.  A loaded font may
+ * have thousands of glyphs, so the cache is direct-mapped: glyph g is
+ * kept in slot g % GLYPH_SLOTS, rendered the first time it is drawn.
+ * The glyphs of an ASCII or Latin font all have slots of their own.
+ */
+static unsigned char *glyphcache;
+static int glyphtag[GLYPH_SLOTS];  /* Glyph in each slot, or -1 */
+static void fbglyphcache(void);
+
+/*
+ * Copy a glyph's rows from the cache into the back buffer, each one S
+ * times.  One is generated for every pixel size B and scale S, so the
+ * row length and the repeat count are constants: the compiler unrolls
+ * the copies into plain moves and the loop tests nothing else.
+ */
+#define BLITTER(B, S) \
+static void blit##B##x##S(unsigned char *dst, const unsigned char *src) \
+{ \
+  int y, i; \
+  for (y = 0 ; y < fontheight ; y++, src += FONT_WIDTH * S * B) \
+    for (i = 0 ; i < S ; i++, dst += backpitch) \
+      memcpy(dst, src, FONT_WIDTH * S * B); \
+}
+#define BLITTERS(B) BLITTER(B, 1) BLITTER(B, 2) BLITTER(B, 3) BLITTER(B, 4)
+BLITTERS(2)
+BLITTERS(3)
+BLITTERS(4)
+
+typedef void (*fbblitter)(unsigned char *, const unsigned char *);
+
+/* Indexed by bytes per pixel - 2 and scale - 1 */
+static const fbblitter blitters[3][FB_MAXSCALE] = {
+  { blit2x1, blit2x2, blit2x3, blit2x4 },
+  { blit3x1, blit3x2, blit3x3, blit3x4 },
+  { blit4x1, blit4x2, blit4x3, blit4x4 },
+};
+static fbblitter blit;
+
+static void fbdamage(int, int, int, int);
+static void fbfill(unsigned char *, int);
+static void fbinvertpixels(unsigned char *);
+static void drawpending(void);
+static unsigned long newestview(const struct pane *);
 
 
 /*
@@ -42,69 +208,541 @@ int shiftOn = 0;
  */
 int fbopen()
 {
-  int fd = open(FBDEV, O_RDWR); /* Open the device */
-  if (fd == -1) return FBOPEN_DEV;
+  return fbopen_surface(NULL, FB_DEFAULTSCALE);
+}
+
+/*
+ * Like fbopen(), but draw on the surface named by spec (see fbsurface.h)
+ * rather than /dev/fb0, with the font scaled up scale times
+ */
+int fbopen_surface(const char *spec, int scale)
+{
+  int err;
+
+  if (scale < 1 || scale > FB_MAXSCALE) return FBOPEN_SIZE;
+  if (fontface.glyphs == NULL &&
+      psf_builtin(&fontface, font, FONT_GLYPHS, FONT_WIDTH, FONT_HEIGHT))
+    return FBOPEN_NOMEM;
+  if ( (err = fbsurface_open(&surface, spec)) != 0 ) return err;
+
+  fontheight = fontface.height;
+  if ( (fallback = psf_glyph(&fontface, UTF8_REPLACEMENT)) == PSF_NOGLYPH &&
+       (fallback = psf_glyph(&fontface, '?')) == PSF_NOGLYPH )
+    fallback = 0;
 
-  if (ioctl(fd, FBIOGET_FSCREENINFO, &fb_finfo)) /* Get fixed info about fb */
-    return FBOPEN_FSCREENINFO;
+  bytespp = surface.var.bits_per_pixel / 8;
+  fontscale = scale;
+  glyphwidth = FONT_WIDTH * scale;
+  glyphheight = fontheight * scale;
+  glyphrowbytes = glyphwidth * bytespp;
+  textcols = surface.var.xres / glyphwidth;
+  textrows = surface.var.yres / glyphheight;
+  if (textcols < 16 || textrows < 4) return FBOPEN_SIZE;
+  receiverows = textrows - 3;
+  blit = blitters[bytespp - 2][scale - 1];
 
-  if (ioctl(fd, FBIOGET_VSCREENINFO, &fb_vinfo)) /* Get varying info about fb */
-    return FBOPEN_VSCREENINFO;
+  backpitch = surface.var.xres * bytespp;
+  backbuffer = calloc(surface.var.yres, backpitch);
+  glyphcache = malloc(GLYPH_SLOTS * fontheight * glyphrowbytes);
+  shownline = malloc(textrows * sizeof(*shownline));
+  cellpitch = (textcols + 1) & ~1;
+  cells = calloc(textrows * cellpitch, sizeof(*cells));
+  shadow = calloc(textrows * cellpitch, sizeof(*shadow));
+  rowchanged = calloc(textrows, 1);
+  if (backbuffer == NULL || glyphcache == NULL || shownline == NULL ||
+      cells == NULL || shadow == NULL || rowchanged == NULL)
+    return FBOPEN_NOMEM;
 
-  if (fb_vinfo.bits_per_pixel != 32) return FBOPEN_BPP; /* Unexpected */
+  /* Flip between two pages if there is room and the driver can pan */
+  npages = 1;
+  shown = 0;
+  pages[0].yoffset = surface.var.yoffset;
+  canpan = surface.pan(&surface) == 0;
+  if (canpan && surface.var.yres_virtual >= 2 * surface.var.yres &&
+      surface.var.yoffset == 0) {
+    npages = 2;
+    pages[1].yoffset = surface.var.yres;
+  }
+
+  /* Neither page shows the back buffer yet */
+  fbdamage(0, 0, surface.var.xres, surface.var.yres);
+
+  fbkernel_init(scale);
+  fbcolors(0xffffff, 0x000000);
 
-  framebuffer = mmap(0, fb_finfo.smem_len, PROT_READ | PROT_WRITE,
-		     MAP_SHARED, fd, 0);
-  if (framebuffer == (unsigned char *)-1) return FBOPEN_MMAP;
+  if (history_init(&found, receiverows, textcols) || fbpanes(1) < 0)
+    return FBOPEN_NOMEM;
 
   return 0;
 }
 
+/* The pixel value of a 0xRRGGBB colour component */
+static uint32_t fbfield(uint32_t rgb, int shift, const struct fb_bitfield *f)
+{
+  return ((rgb >> shift) & 0xff) >> (8 - f->length) << f->offset;
+}
+
+/* The pixel value of a 0xRRGGBB colour */
+static uint32_t fbpixel(uint32_t rgb)
+{
+  return fbfield(rgb, 16, &surface.var.red) |
+    fbfield(rgb, 8, &surface.var.green) |
+    fbfield(rgb, 0, &surface.var.blue);
+}
+
+/*
+ * Empty the glyph cache, as its glyphs are in the old colours
+ */
+static void fbglyphcache(void)
+{
+  int i;
+
+  for (i = 0 ; i < GLYPH_SLOTS ; i++) glyphtag[i] = -1;
+}
+
+/*
+ * The pre-rendered rows of glyph g, expanding it into its slot in the
+ * current colours, each font pixel repeated fontscale times across, if
+ * the slot holds some other glyph
+ */
+static const unsigned char *fbcachedglyph(int g)
+{
+  int slot = g % GLYPH_SLOTS, y, x;
+  const unsigned char *rows;
+  unsigned char *pixel;
+  uint32_t value;
+
+  pixel = glyphcache + slot * fontheight * glyphrowbytes;
+  if (glyphtag[slot] == g) return pixel;
+  glyphtag[slot] = g;
+
+  rows = fontface.glyphs + g * fontface.charsize;
+  for (y = 0 ; y < fontheight ; y++)
+    for (x = 0 ; x < glyphwidth ; x++, pixel += bytespp) {
+      value = (rows[y] & (0x80 >> (x / fontscale))) ? fgpixel : bgpixel;
+      memcpy(pixel, &value, bytespp); /* Little-endian */
+    }
+  return glyphcache + slot * fontheight * glyphrowbytes;
+}
+
+/*
+ * Draw with the given foreground and background colours, each
+ * 0xRRGGBB.  Every cell is drawn again in them at the next flush.
+ */
+void fbcolors(uint32_t fg, uint32_t bg)
+{
+  int row, col;
+
+  fgpixel = fbpixel(fg);
+  bgpixel = fbpixel(bg);
+  fbglyphcache();
+  for (row = 0 ; row < textrows ; row++) {
+    for (col = 0 ; col < textcols ; col++)
+      shadow[row * cellpitch + col] = FBCELL_STALE;
+    rowchanged[row] = 1;
+  }
+}
+
 /*
- * Draw the given character at the given row/column.
- * fbopen() must be called first.
+ * Draw with the PSF2 font at path instead of the built-in one.  Must be
+ * called before the framebuffer is opened, as the font's height sets
+ * the size of the text grid.  Glyphs must be 8 pixels wide.  Returns 0
+ * on success or FBOPEN_FONT if the font could not be loaded.
+ */
+int fbsetfont(const char *path)
+{
+  struct psf f;
+
+  if (psf_open(&f, path) != 0) return FBOPEN_FONT;
+  if (f.width != FONT_WIDTH || f.height > FONT_MAXHEIGHT) {
+    psf_close(&f);
+    return FBOPEN_FONT;
+  }
+  if (fontface.glyphs != NULL) psf_close(&fontface);
+  fontface = f;
+  return 0;
+}
+
+/* The size of the text grid */
+int fbcols(void)
+{
+  return textcols;
+}
+
+int fbrows(void)
+{
+  return textrows;
+}
+
+/*
+ * Show the character with Unicode codepoint cp at the given row/column,
+ * or a replacement if the font has no glyph for it, from the next
+ * flush on.  fbopen() must be called first.
+ */
+void fbputcode(uint32_t cp, int row, int col)
+{
+  if (row < 0 || row >= textrows || col < 0 || col >= textcols) return;
+  cells[row * cellpitch + col] = cp & ~FBCELL_INVERSE;
+  rowchanged[row] = 1;
+}
+
+/*
+ * Draw the given character at the given row/column.  Bytes above 0x7F
+ * are taken as Latin-1.
  */
 void fbputchar(char c, int row, int col)
 {
-  int x, y;
-  unsigned char pixels, *pixelp = font + FONT_HEIGHT * c;
-  unsigned char mask;
-  unsigned char *pixel, *left = framebuffer +
-    (row * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +
-    (col * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-  for (y = 0 ; y < FONT_HEIGHT * 2 ; y++, left += fb_finfo.line_length) {
-    pixels = *pixelp;
-    pixel = left;
-    mask = 0x80;
-    for (x = 0 ; x < FONT_WIDTH ; x++) {
-      if (pixels & mask) {	
-	pixel[0] = 255; /* Red */
-        pixel[1] = 255; /* Green */
-        pixel[2] = 255; /* Blue */
-        pixel[3] = 0;
-      } else {
-	pixel[0] = 0;
-        pixel[1] = 0;
-        pixel[2] = 0;
-        pixel[3] = 0;
+  fbputcode((unsigned char) c, row, col);
+}
+
+static int rectarea(const struct fbrect *r)
+{
+  return r->w * r->h;
+}
+
+static struct fbrect rectunion(const struct fbrect *a, const struct fbrect *b)
+{
+  struct fbrect u;
+  int right = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+  int bottom = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+  u.x = a->x < b->x ? a->x : b->x;
+  u.y = a->y < b->y ? a->y : b->y;
+  u.w = right - u.x;
+  u.h = bottom - u.y;
+  return u;
+}
+
+/*
+ * Add r to the damage of page p.  Rectangles are merged whenever the
+ * union costs no more to copy than the two separately (neighbouring
+ * cells on a row, overlapping redraws).  When the list is full, r is
+ * merged with whichever rectangle grows the least.
+ */
+static void pagedamage(struct fbpage *p, struct fbrect r)
+{
+  int i, best, growth, bestgrowth;
+  struct fbrect u;
+
+ again:
+  for (i = 0 ; i < p->ndamage ; i++) {
+    u = rectunion(&p->damage[i], &r);
+    if (rectarea(&u) <= rectarea(&p->damage[i]) + rectarea(&r)) {
+      r = u;
+      p->damage[i] = p->damage[--p->ndamage];
+      goto again;
+    }
+  }
+
+  if (p->ndamage == FB_MAXDAMAGE) {
+    best = 0;
+    bestgrowth = -1;
+    for (i = 0 ; i < p->ndamage ; i++) {
+      u = rectunion(&p->damage[i], &r);
+      growth = rectarea(&u) - rectarea(&p->damage[i]);
+      if (bestgrowth < 0 || growth < bestgrowth) {
+	best = i;
+	bestgrowth = growth;
       }
-      pixel += 4;
-      if (pixels & mask) {
-	pixel[0] = 255; /* Red */
-        pixel[1] = 255; /* Green */
-        pixel[2] = 255; /* Blue */
-        pixel[3] = 0;
-      } else {
-	pixel[0] = 0;
-        pixel[1] = 0;
-        pixel[2] = 0;
-        pixel[3] = 0;
+    }
+    r = rectunion(&p->damage[best], &r);
+    p->damage[best] = p->damage[--p->ndamage];
+    goto again;
+  }
+
+  p->damage[p->ndamage++] = r;
+}
+
+/*
+ * Note that the given pixels of the back buffer changed.  Every page
+ * has to pick them up before it is next shown.
+ */
+static void fbdamage(int x, int y, int w, int h)
+{
+  int i;
+  struct fbrect r;
+
+  if (x + w > (int) surface.var.xres) w = surface.var.xres - x;
+  if (y + h > (int) surface.var.yres) h = surface.var.yres - y;
+  if (w <= 0 || h <= 0) return;
+  r.x = x;
+  r.y = y;
+  r.w = w;
+  r.h = h;
+
+  pthread_mutex_lock(&fblock);
+  for (i = 0 ; i < npages ; i++) pagedamage(&pages[i], r);
+  changed = 1;
+  pthread_mutex_unlock(&fblock);
+}
+
+/*
+ * Page p has been panned down by k lines, so the band of rows [y0, y1)
+ * appears to have scrolled up by k and everything outside the band has
+ * moved with it.  Damage inside the band moves up too; everything
+ * outside the part of the band that was kept has to be redrawn.
+ */
+static void pagescroll(struct fbpage *p, int y0, int y1, int k)
+{
+  struct fbrect old[FB_MAXDAMAGE], r;
+  int i, n = p->ndamage, top, bottom;
+
+  memcpy(old, p->damage, sizeof(old));
+  p->ndamage = 0;
+  p->yoffset += k;
+
+  for (i = 0 ; i < n ; i++) {
+    r = old[i];
+    top = (r.y > y0 ? r.y : y0) - k;
+    bottom = (r.y + r.h < y1 ? r.y + r.h : y1) - k;
+    if (top < y0) top = y0;
+    if (bottom <= top) continue;
+    r.y = top;
+    r.h = bottom - top;
+    pagedamage(p, r);
+  }
+
+  r.x = 0;
+  r.w = surface.var.xres;
+  if (y0 > 0) {
+    r.y = 0;
+    r.h = y0;
+    pagedamage(p, r);
+  }
+  r.y = y1 - k;
+  r.h = surface.var.yres - r.y;
+  pagedamage(p, r);
+}
+
+/*
+ * Scroll text rows row .. row + nrows - 1 up by lines rows.  The bottom
+ * lines rows of the band are left as they were and must be redrawn by
+ * the caller.
+ */
+static void fbscroll(int row, int nrows, int lines)
+{
+  int y0 = row * glyphheight, y1 = (row + nrows) * glyphheight;
+  int k = lines * glyphheight;
+  int kept = y1 - y0 - k;
+  int room = surface.var.yres_virtual - npages * surface.var.yres;
+  int i, bottom;
+  struct fbrect r;
+
+  memmove(backbuffer + y0 * backpitch, backbuffer + (y0 + k) * backpitch,
+	  kept * backpitch);
+
+  /* The cells go with their pixels, so what moved is not drawn again */
+  memmove(cells + row * cellpitch, cells + (row + lines) * cellpitch,
+	  (nrows - lines) * cellpitch * sizeof(*cells));
+  memmove(shadow + row * cellpitch, shadow + (row + lines) * cellpitch,
+	  (nrows - lines) * cellpitch * sizeof(*shadow));
+  memmove(rowchanged + row, rowchanged + row + lines, nrows - lines);
+
+  pthread_mutex_lock(&fblock);
+  changed = 1;
+  r.x = 0;
+  r.w = surface.var.xres;
+
+  /* Panning moves the whole screen, so it only pays if fewer rows have
+     to be redrawn afterwards than were scrolled */
+  if (canpan && room >= k && (int) surface.var.yres - kept < kept) {
+    bottom = 0;
+    for (i = 0 ; i < npages ; i++)
+      if (pages[i].yoffset + (int) surface.var.yres > bottom)
+	bottom = pages[i].yoffset + surface.var.yres;
+
+    if (bottom + k <= (int) surface.var.yres_virtual) {
+      for (i = 0 ; i < npages ; i++) pagescroll(&pages[i], y0, y1, k);
+    } else {
+      /* Out of room: go back to the top and redraw everything there */
+      r.y = 0;
+      r.h = surface.var.yres;
+      for (i = 0 ; i < npages ; i++) {
+	pages[i].yoffset = i * surface.var.yres;
+	pages[i].ndamage = 0;
+	pagedamage(&pages[i], r);
       }
-      pixel += 4;
-      mask >>= 1;
     }
-    if (y & 0x1) pixelp++;
+  } else {
+    r.y = y0;
+    r.h = y1 - y0;
+    for (i = 0 ; i < npages ; i++) pagedamage(&pages[i], r);
+  }
+  pthread_mutex_unlock(&fblock);
+}
+
+/*
+ * Blank n cells of the back buffer from row, col.  A blank is all
+ * background, so this is a fill of each pixel row rather than a glyph
+ * per cell.
+ */
+static void drawblanks(int row, int col, int n)
+{
+  unsigned char *left = backbuffer + row * glyphheight * backpitch +
+    col * glyphrowbytes;
+  int y;
+
+  for (y = 0 ; y < glyphheight ; y++, left += backpitch)
+    fbfill(left, n * glyphwidth);
+}
+
+/*
+ * Draw the character in cell into the back buffer at row, col
+ */
+static void drawcell(int row, int col, uint32_t cell)
+{
+  unsigned char *left = backbuffer + row * glyphheight * backpitch +
+    col * glyphrowbytes;
+  int inverse = (cell & FBCELL_INVERSE) != 0, glyph;
+
+  if ( (glyph = psf_glyph(&fontface, cell & ~FBCELL_INVERSE)) == PSF_NOGLYPH )
+    glyph = fallback;
+  if (bytespp == 4 && fbkernel_expand != NULL) {
+    fbkernel_expand(left, backpitch, fontface.glyphs + glyph * fontface.charsize,
+		    fontheight, inverse ? bgpixel : fgpixel,
+		    inverse ? fgpixel : bgpixel);
+    return;
+  }
+  blit(left, fbcachedglyph(glyph));
+  if (inverse) fbinvertpixels(left);
+}
+
+/*
+ * Draw every cell that differs from what it showed when last drawn,
+ * and damage the part of each row that changed.  Only rows written
+ * since the last flush are looked at, two cells at a time; changed
+ * cells that are blank are filled a run at a time.
+ */
+static void drawcells(void)
+{
+  const uint64_t *now, *was;
+  int row, w, col, first, last, blanks, i;
+
+  for (row = 0 ; row < textrows ; row++) {
+    if (!rowchanged[row]) continue;
+    rowchanged[row] = 0;
+    now = (const uint64_t *) (cells + row * cellpitch);
+    was = (const uint64_t *) (shadow + row * cellpitch);
+    first = last = blanks = -1;
+    for (w = 0 ; w < cellpitch / 2 ; w++) {
+      if (now[w] == was[w]) continue;
+      for (col = 2 * w ; col < 2 * w + 2 && col < textcols ; col++) {
+	i = row * cellpitch + col;
+	if (cells[i] == shadow[i]) continue;
+	if (blanks >= 0 && (cells[i] != FBCELL_BLANK || col != last + 1)) {
+	  drawblanks(row, blanks, last + 1 - blanks);
+	  blanks = -1;
+	}
+	if (cells[i] == FBCELL_BLANK) {
+	  if (blanks < 0) blanks = col;
+	} else
+	  drawcell(row, col, cells[i]);
+	shadow[i] = cells[i];
+	if (first < 0) first = col;
+	last = col;
+      }
+    }
+    if (blanks >= 0) drawblanks(row, blanks, last + 1 - blanks);
+    if (first >= 0)
+      fbdamage(first * glyphwidth, row * glyphheight,
+	       (last - first + 1) * glyphwidth, glyphheight);
+  }
+}
+
+/*
+ * Bring the framebuffer up to date with everything drawn so far.  The
+ * cells that changed are drawn into the back buffer, and the damaged
+ * rectangles copied to the page being drawn; when flipping, that is the
+ * hidden page, which is then panned into view.
+ */
+void fbflush()
+{
+  int i, y;
+  struct fbpage *p;
+  struct fbrect *r;
+  unsigned char *src, *dst;
+
+  drawpending();
+  drawcells();
+
+  pthread_mutex_lock(&fblock);
+  if (!changed) {
+    pthread_mutex_unlock(&fblock);
+    return;
+  }
+  if (waitvsync) surface.vsync(&surface);
+
+  p = &pages[npages == 2 ? !shown : shown];
+  for (i = 0 ; i < p->ndamage ; i++) {
+    r = &p->damage[i];
+    src = backbuffer + r->y * backpitch + r->x * bytespp;
+    dst = surface.mem + (p->yoffset + r->y) * surface.fix.line_length +
+      (surface.var.xoffset + r->x) * bytespp;
+    for (y = 0 ; y < r->h ; y++) {
+      fbkernel_copy(dst, src, r->w * bytespp);
+      src += backpitch;
+      dst += surface.fix.line_length;
+    }
+  }
+  p->ndamage = 0;
+  fbkernel_fence();
+
+  if (npages == 2) {
+    surface.var.yoffset = p->yoffset;
+    if (surface.pan(&surface) == 0)
+      shown = !shown;
+  } else if (p->yoffset != (int) surface.var.yoffset) {
+    /* The page was moved by a scroll */
+    surface.var.yoffset = p->yoffset;
+    surface.pan(&surface);
   }
+  changed = 0;
+  pthread_mutex_unlock(&fblock);
+}
+
+/*
+ * Have fbflush() wait for the vertical blank before it updates the
+ * screen, so there is no tearing and flushes are paced by the display,
+ * or stop waiting.  Returns 0, or -1 if the display cannot say when
+ * its blank is.
+ */
+int fbvsync(int on)
+{
+  if (on && surface.vsync(&surface) < 0) return -1;
+  waitvsync = on;
+  return 0;
+}
+
+/*
+ * The least time between two flushes, in ms, asked for by spec (e.g.
+ * FBFPS): a number of frames a second, or "vsync" to flush once per
+ * vertical blank, when fbflush() does the waiting and this returns 0.
+ * Anything else, or a display without a blank to wait for, gets
+ * FB_DEFAULTFPS.  The framebuffer must be open.
+ */
+int fbframems(const char *spec)
+{
+  int fps = FB_DEFAULTFPS;
+
+  if (spec != NULL && strcmp(spec, "vsync") == 0) {
+    if (fbvsync(1) == 0) return 0;
+    fprintf(stderr, "No vertical blank to wait for, using %d fps\n", fps);
+  } else if (spec != NULL && atoi(spec) > 0)
+    fps = atoi(spec);
+  return (1000 + fps - 1) / fps;
+}
+
+/*
+ * Save what the screen shows, as of the last fbflush(), to path as a
+ * PPM image.  Returns 0 on success or -1 if it could not be written.
+ */
+int fbdump(const char *path)
+{
+  int err;
+
+  pthread_mutex_lock(&fblock);
+  err = fbsurface_ppm(&surface, path);
+  pthread_mutex_unlock(&fblock);
+  return err;
 }
 
 /*
@@ -117,182 +755,434 @@ void fbputs(const char *s, int row, int col)
   while ((c = *s++) != 0) fbputchar(c, row, col++);
 }
 
+/*
+ * Set n pixels to the background colour: a memset when it is black
+ */
+static void fbfill(unsigned char *dst, int n)
+{
+  int i;
+
+  if (bgpixel == 0) {
+    memset(dst, 0, n * bytespp);
+    return;
+  }
+  for (i = 0 ; i < n ; i++, dst += bytespp)
+    memcpy(dst, &bgpixel, bytespp);
+}
+
+/*
+ * Blank the given row from col to the right edge
+ */
+static void fbblankto(int row, int col)
+{
+  memset(cells + row * cellpitch + col, 0,
+	 (textcols - col) * sizeof(*cells)); /* FBCELL_BLANK */
+  rowchanged[row] = 1;
+}
+
+/*
+ * Blank nrows text rows starting at row
+ */
+static void fbblank(int row, int nrows)
+{
+  for ( ; nrows > 0 ; nrows--, row++)
+    fbblankto(row, 0);
+}
+
 /*
  * Clears the framebuffer
  */
 void fbclear()
 {
-	for (int col = 0; col < 64; col++) {
-		for (int row = 0; row < 24; row++) {
-			fbputchar(' ', row, col);
-		}
-	}
+	fbblank(0, textrows);
+	for (int row = 0; row < textrows; row++)
+		shownline[row] = NOLINE;
 }
 
 void fbclearrow(int row)
 {
-	for (int col = 0; col < 64; col++) {
-		fbputchar(' ', row, col);
-	}
+	fbblank(row, 1);
 }
 
 void fbclearreceive()
 {
-	for (int row = 0; row < 21; row++) {
-		fbclearrow(row);
-	}
+	fbblank(0, receiverows);
+	for (int row = 0; row < textrows; row++)
+		shownline[row] = NOLINE;
 }
 
 /*
- * Converts the hexadecimal keystate into
- * ASCII characters
+ * Swap the foreground and background of the character at row, col
  */
- char hex2ascii	(int hex)
- {
-	char ascii;
-	if (hex > 29) { // number is pressed
-		ascii = (char)hex + 19;
-	} else { // letter is pressed
-		ascii = (char)hex + 93; 
-	}
+static void fbinvert(int row, int col)
+{
+  cells[row * cellpitch + col] ^= FBCELL_INVERSE;
+  rowchanged[row] = 1;
+}
 
-	return ascii;
- }
-
- /*
-  * Capitalizes the ASCII characters
-  */
- char capitalize(char c)
- {
-	return c - 32;
- }
-
- /*
-  * Handles a keypress
-  * Takes a keypress and returns the
-  * correct format
-  */
-char keyHandler(struct usb_keyboard_packet *packet)
-{
-	int modifiers = packet->modifiers;
-	int keycode0 = (packet->keycode)[0];
-	int keycode1 = (packet->keycode)[1];
-	int shiftPressed = 0;
-	 /* Return NULL character if no key is pressed */
-    if (keycode0 == 0)
-	return '\0';
-	printf("%d %d %d\n", unshift, lastKey, keycode0);
-	if (unshift == 1 && lastKey == keycode0 && keycode1 == 0){
-			return '\0';
-	}
+/*
+ * Swap the foreground and background of the cell drawn at left.  Every
+ * pixel of a cell is one or the other, so XORing each with both swaps
+ * them, whatever the pixel format.
+ */
+static void fbinvertpixels(unsigned char *left)
+{
+  uint32_t flip = fgpixel ^ bgpixel;
+  unsigned char bytes[4];
+  int y, x;
 
-    /* Handle Letter Keys */
-	if ((modifiers == 0x02 || modifiers == 0x20) && keycode1 > 3 && keycode1 < 30 && !unshift){
-			unshift = 1;
-			lastKey  = keycode0;
-			return capitalize(hex2ascii(keycode1));
-	}
-	else if (modifiers == 0x00 && keycode1 > 3 && keycode1 < 30){
-			unshift = 1;
-			lastKey = '\0';
-			return hex2ascii(keycode1);
-	}
-    else if ((modifiers == 0x02 || modifiers == 0x20) && keycode0 > 3 && keycode0 < 30 && keycode1 == 0) {
-		if(unshift){
-				unshift = 0;
-				lastKey = keycode0;
-				return '\0';
-		}
-		return capitalize(hex2ascii(keycode0));  // Capitalized letters
-    } else if (modifiers == 0x00 && keycode0 > 3 && keycode0 < 30 && keycode1 == 0) {
-		if(unshift){
-				lastKey=modifiers;
-				unshift = 0;
-				return '\0';
-		}
-		return hex2ascii(keycode0);  // Lowercase letters
-    }
+  memcpy(bytes, &flip, sizeof(bytes)); /* Little-endian */
+  for (y = 0 ; y < glyphheight ; y++, left += backpitch)
+    for (x = 0 ; x < glyphrowbytes ; x++)
+      left[x] ^= bytes[x % bytespp];
+}
 
-    /* Handle Numbers and Punctuation */
-    if (keycode0 >= 30 && keycode0 <= 39) {
-	// Number keys (1-9, 0) and their Shifted symbols (!@#$%^&*())
-	char normal[] = "1234567890";
-	char shifted[] = "!@#$%^&*()";
-	int index = keycode0 - 30;
-	return ((modifiers & 0x02)||(modifiers & 0x20)) ? shifted[index] : normal[index];
+/*
+ * The pane numbered i, or NULL if there is no such pane
+ */
+static struct pane *getpane(int i)
+{
+  return i >= 0 && i < npanes ? &panes[i] : NULL;
+}
+
+/*
+ * Split the receive rows into n panes, stacked from the top, each a
+ * title row and at least one row of text; a single pane has no title
+ * and takes all of them.  Panes that were there before keep their
+ * scrollback, and every pane is redrawn at the next flush.  Returns 0,
+ * or -1 if n panes do not fit or a scrollback could not be allocated.
+ */
+int fbpanes(int n)
+{
+  struct pane *p;
+  int row = 0, i, rows;
+
+  if (n < 1 || n > FB_MAXPANES || (n > 1 && receiverows / n < 2)) return -1;
+
+  pthread_mutex_lock(&receivelock);
+  for ( ; madepanes < n ; madepanes++) {
+    p = &panes[madepanes];
+    if (history_init(&p->scrollback, HISTORY_LINES, textcols) < 0) {
+      pthread_mutex_unlock(&receivelock);
+      return -1;
     }
+    utf8_init(&p->received);
+    p->view = &p->scrollback;
+    p->viewtop = p->wanttop = p->scrollback.first;
+    p->following = 1;
+  }
+
+  for (i = 0 ; i < n ; i++) {
+    p = &panes[i];
+    rows = n == 1 ? receiverows : receiverows / n + (i < receiverows % n);
+    p->top = row + (n > 1);
+    p->rows = rows - (n > 1);
+    p->shownline = shownline + p->top;
+    p->viewtop = p->following || p->view != &p->scrollback ?
+      newestview(p) : p->wanttop;
+    p->dirty = 1;
+    row += rows;
+  }
+  npanes = n;
+
+  fbblank(0, receiverows);
+  for (row = 0 ; row < textrows ; row++) shownline[row] = NOLINE;
+  pthread_mutex_unlock(&receivelock);
+  return 0;
+}
 
-    /* Handle Space, Enter, Backspace, Tab, Escape */
-    switch (keycode0) {
-	case 44: return ' ';  // Space
-	case 40: return '\n'; // Enter
-	case 42: return '\b'; // Backspace
-	case 43: return '\t'; // Tab
-	case 41: return 27;   // Escape (ASCII code 27)
+/*
+ * The title row of pane i, or -1 if it has none
+ */
+int fbpanetitle(int i)
+{
+  return i >= 0 && i < npanes && npanes > 1 ? panes[i].top - 1 : -1;
+}
+
+/*
+ * The rows of text in pane i, or 0 if there is no such pane
+ */
+int fbpanerows(int i)
+{
+  return i >= 0 && i < npanes ? panes[i].rows : 0;
+}
+
+/*
+ * Draw line seq of the pane's view on its row, blanking whatever is
+ * left of the row, and invert the text being searched for wherever it
+ * is.  Skipped if the row already shows the line.
+ */
+static void drawreceiverow(struct pane *p, int row, unsigned long seq)
+{
+  const uint32_t *text;
+  int col, n = 0, lit = 0, i;
+
+  text = history_line(p->view, seq, &n);
+  if (text == NULL) seq = NOLINE;
+  if (p->shownline[row] == seq) return;
+  p->shownline[row] = seq;
+  row += p->top;
+
+  for (col = 0 ; col < n ; col++) {
+    fbputcode(text[col], row, col);
+    if (p->view == &found && col + highlightlen <= n) {
+      for (i = 0 ; i < highlightlen && text[col + i] == highlight[i] ; i++)
+	;
+      if (i == highlightlen) lit = col + highlightlen;
     }
+    if (col < lit) fbinvert(row, col);
+  }
+  if (col < textcols) fbblankto(row, col);
+}
+
+/*
+ * Move the pane's rows on so that line top is on its first row.  If
+ * some of the lines already on screen stay visible, they are scrolled
+ * rather than redrawn.
+ */
+static void scrollreceive(struct pane *p, unsigned long top)
+{
+  int lines, row;
+
+  if (top > p->viewtop && top - p->viewtop < p->rows) {
+    lines = top - p->viewtop;
+    fbscroll(p->top, p->rows, lines);
+    for (row = 0 ; row < p->rows ; row++)
+      p->shownline[row] = row + lines < p->rows ?
+	p->shownline[row + lines] : STALE;
+  }
+  p->viewtop = top;
+}
 
-    /* Handle Special Symbols (Punctuation) */
-    if ((keycode0 >= 45 && keycode0 <= 49) || (keycode0 >= 51 && keycode0 <= 52) || (keycode0 >= 54 && keycode0 <= 56)) {
-    char normal[] = "-=[]\\;'"
-                    ",./";
-    char shifted[] = "_+{}|:\"<>?";
-    int index;
-    if (keycode0 >= 45 && keycode0 <= 49) {
-        index = keycode0 - 45;
-    } else if (keycode0 >= 51 && keycode0 <= 52) {
-        // Skip keycode 50
-        index = (keycode0 - 45) - 1;
-    } else {  // keycode0 is 54, 55, or 56; skip keycodes 50 and 53
-        index = (keycode0 - 45) - 2;
+/*
+ * Bring the pane's rows up to date with the lines starting at viewtop
+ */
+static void drawreceive(struct pane *p)
+{
+  int row;
+
+  for (row = 0 ; row < p->rows ; row++)
+    drawreceiverow(p, row, p->viewtop + row);
+}
+
+/*
+ * The line on the pane's first row when the newest line is on its
+ * last, or the oldest line if there are not enough to fill the rows
+ */
+static unsigned long newestview(const struct pane *p)
+{
+  return p->view->end - p->view->first > p->rows ?
+    p->view->end - p->rows : p->view->first;
+}
+
+/*
+ * Add n bytes of UTF-8 to the message being received in a pane.  A
+ * message may arrive in any number of spans, split anywhere, even
+ * inside a character; it is decoded a chunk at a time and wrapped into
+ * lines as wide as the screen as it goes into the scrollback.
+ */
+void print_span(int pane, const char *s, int n)
+{
+    struct pane *p = getpane(pane);
+    uint32_t text[RECEIVE_CHUNK + 1];
+    int chunk, decoded;
+
+    if (p == NULL) return;
+    pthread_mutex_lock(&receivelock);
+    for ( ; n > 0 ; s += chunk, n -= chunk) {
+        chunk = n < RECEIVE_CHUNK ? n : RECEIVE_CHUNK;
+        decoded = utf8_decode(&p->received, s, chunk, text);
+        history_write(&p->scrollback, text, decoded);
     }
-    return (modifiers & 0x02) ? shifted[index] : normal[index];
+    pthread_mutex_unlock(&receivelock);
 }
 
-    /* Handle Function Keys (F1-F12) */
-    if (keycode0 >= 58 && keycode0 <= 69) {
-	return (char)(keycode0 - 58 + 'F');  // Return 'F' for Function keys
+/*
+ * Finish the message being received in a pane.  It is shown at the
+ * next flush.
+ */
+void print_end(int pane)
+{
+    struct pane *p = getpane(pane);
+    uint32_t last;
+
+    if (p == NULL) return;
+    pthread_mutex_lock(&receivelock);
+    if (utf8_finish(&p->received, &last))
+        history_write(&p->scrollback, &last, 1);
+    history_endline(&p->scrollback);
+    p->dirty = 1;
+    pthread_mutex_unlock(&receivelock);
+}
+
+/*
+ * Bring the rows of every pane up to date, if anything was received or
+ * paged since they last were.  Following the newest lines, that is
+ * only the last rows of the pane, so however many messages came in
+ * since, the rows scroll once and each is drawn at most once.
+ */
+static void drawpending(void)
+{
+    struct pane *p;
+
+    pthread_mutex_lock(&receivelock);
+    for (p = panes ; p < panes + npanes ; p++) {
+        if (!p->dirty) continue;
+        if (!p->following && p->wanttop < p->scrollback.first)
+            p->wanttop = p->scrollback.first;
+        scrollreceive(p, p->following || p->view != &p->scrollback ?
+                      newestview(p) : p->wanttop);
+        drawreceive(p);
+        p->dirty = 0;
     }
+    pthread_mutex_unlock(&receivelock);
+}
+
+/*
+ * Put a whole message of n bytes of UTF-8, older than anything in the
+ * pane's scrollback, in front of the oldest line.  Returns the number
+ * of lines it takes, or -1 if the scrollback has no room for it.
+ */
+int print_older(int pane, const char *s, int n)
+{
+    struct pane *p = getpane(pane);
+    struct utf8 u;
+    uint32_t *text, last;
+    int decoded, lines;
 
-    /* Handle Arrow Keys */
-    switch (keycode0) {
-	case 79: return 1;   // Right Arrow
-	case 80: return 2;   // Left Arrow
-	case 81: return 3;   // Down Arrow
-	case 82: return 4;   // Up Arrow
+    if (p == NULL) return -1;
+    if ( (text = malloc((n + 2) * sizeof(*text))) == NULL ) return -1;
+    utf8_init(&u);
+    decoded = utf8_decode(&u, s, n, text);
+    if (utf8_finish(&u, &last)) text[decoded++] = last;
+
+    pthread_mutex_lock(&receivelock);
+    if ( (lines = history_prepend(&p->scrollback, text, decoded)) > 0 )
+        p->dirty = 1;
+    pthread_mutex_unlock(&receivelock);
+    free(text);
+    return lines;
+}
+
+/*
+ * Have fn called to bring back older lines when paging reaches the
+ * oldest line in a pane's scrollback.  fn(pane, lines) should add at
+ * least that many with print_older() if it can, and return the number
+ * it added.
+ */
+void fbscrollback(fbolder_fn fn)
+{
+    older = fn;
+}
+
+/*
+ * Show search results in a pane instead of its scrollback: none to
+ * begin with, then each message given to print_found(), with the n
+ * bytes of UTF-8 at s in inverse video wherever they are.  With n == 0,
+ * go back to showing the scrollback.  Only one pane shows results at a
+ * time.
+ */
+void print_search(int pane, const char *s, int n)
+{
+    struct pane *p, *showing = getpane(pane);
+    struct utf8 u;
+    uint32_t last;
+    int row;
+
+    if (n > HIGHLIGHT_MAX) n = HIGHLIGHT_MAX;
+    pthread_mutex_lock(&receivelock);
+    utf8_init(&u);
+    highlightlen = utf8_decode(&u, s, n, highlight);
+    if (utf8_finish(&u, &last)) highlight[highlightlen++] = last;
+    history_clear(&found);
+
+    for (p = panes ; p < panes + npanes ; p++) {
+        if (p->view != (p == showing && n > 0 ? &found : &p->scrollback)) {
+            p->view = p == showing && n > 0 ? &found : &p->scrollback;
+
+            /* The rows' line numbers mean nothing in the other view */
+            for (row = 0 ; row < p->rows ; row++) p->shownline[row] = STALE;
+            p->viewtop = p->following || p->view == &found ?
+                newestview(p) : p->wanttop;
+        }
+        if (p->view == &found) p->dirty = 1;
     }
+    pthread_mutex_unlock(&receivelock);
+}
+
+/*
+ * Add a message of n bytes of UTF-8 to the search results, below the
+ * others.  Only the last screenful is kept.
+ */
+void print_found(const char *s, int n)
+{
+    uint32_t text[RECEIVE_CHUNK + 1];
+    struct pane *p;
+    struct utf8 u;
+    int chunk, decoded;
 
-    return '\0';  // No valid key detected
+    pthread_mutex_lock(&receivelock);
+    utf8_init(&u);
+    for ( ; n > 0 ; s += chunk, n -= chunk) {
+        chunk = n < RECEIVE_CHUNK ? n : RECEIVE_CHUNK;
+        decoded = utf8_decode(&u, s, chunk, text);
+        history_write(&found, text, decoded);
+    }
+    if (utf8_finish(&u, text)) history_write(&found, text, 1);
+    history_endline(&found);
+    for (p = panes ; p < panes + npanes ; p++)
+        if (p->view == &found) p->dirty = 1;
+    pthread_mutex_unlock(&receivelock);
 }
 
 /*
- * Tokenizes a string into 64 size chunnks
+ * Show a whole message on the next free line(s) of the first pane
+ * straight away
  */
 void print_to_screen(const char *received_str, int *freeRow, int received_chars) {
-    int chars_remaining = received_chars;
-    int offset = 0;
-
-    while (chars_remaining > 0) {
-        // Check if screen is full, reset if necessary
-        if (*freeRow >= 21) {
-            fbclearreceive();
-            *freeRow = 0;
-        }
+    print_span(0, received_str, received_chars);
+    print_end(0);
+    drawpending();
+    *freeRow = panes[0].scrollback.end - panes[0].viewtop;
+}
 
-        // Extract a 64-character chunk
-        char buffer[64 + 1];  // +1 for null terminator
-        int chunk_size = (chars_remaining > 64) ? 64 : chars_remaining;
+/*
+ * Page a pane through its scrollback: negative pages go back in time,
+ * positive ones forward.  Paging forward onto the newest lines resumes
+ * following new messages.  The rows move at the next flush.
+ */
+void print_scroll(int pane, int count)
+{
+  struct pane *p = getpane(pane);
+  unsigned long newest, oldest, top;
+  long wanted;
 
-        strncpy(buffer, received_str + offset, chunk_size);
-        buffer[chunk_size] = '\0';  // Null terminate
+  if (p == NULL) return;
+  pthread_mutex_lock(&receivelock);
+  if (p->view != &p->scrollback || p->scrollback.end == p->scrollback.first) {
+    pthread_mutex_unlock(&receivelock);
+    return;
+  }
+  newest = newestview(p);
+  oldest = p->scrollback.first;
 
-        // Print to framebuffer at current free row
-        fbputs(buffer, *freeRow, 0);
+  /* Paging back past the oldest line: fetch some more first */
+  top = p->following ? newest : p->wanttop < oldest ? oldest : p->wanttop;
+  wanted = (long) count * p->rows;
+  if (older != NULL && wanted < 0 && top - oldest < (unsigned long) -wanted) {
+    pthread_mutex_unlock(&receivelock);
+    older(pane, oldest + -wanted - top);
+    pthread_mutex_lock(&receivelock);
+    newest = newestview(p);
+    oldest = p->scrollback.first;
+  }
 
-        // Move to the next line
-        (*freeRow)++;
-        offset += chunk_size;
-        chars_remaining -= chunk_size;
-    }
+  top = (long) (top - oldest) + wanted < 0 ? oldest : top + wanted;
+  if (top > newest) top = newest;
+  p->wanttop = top;
+  p->following = p->wanttop == newest;
+  p->dirty = 1;
+  pthread_mutex_unlock(&receivelock);
 }
 
 /* 8 X 16 console font from /lib/kbd/consolefonts/lat0-16.psfu.gz
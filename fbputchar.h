@@ -1,23 +1,53 @@
 #ifndef _FBPUTCHAR_H
 #  define _FBPUTCHAR_H
 
+#include <stdint.h>
+
 #define FBOPEN_DEV -1          /* Couldn't open the device */
 #define FBOPEN_FSCREENINFO -2  /* Couldn't read the fixed info */
 #define FBOPEN_VSCREENINFO -3  /* Couldn't read the variable info */
 #define FBOPEN_MMAP -4         /* Couldn't mmap the framebuffer memory */
 #define FBOPEN_BPP -5          /* Unexpected bits-per-pixel */
+#define FBOPEN_NOMEM -6        /* Couldn't allocate the back buffer */
+#define FBOPEN_SURFACE -7      /* Couldn't make sense of the surface name */
+#define FBOPEN_SIZE -8         /* Bad scale, or too small for the text */
+#define FBOPEN_FONT -9         /* Couldn't load the font, or can't use it */
+
+#define FB_DEFAULTSCALE 2      /* Font pixels are drawn 2x2 by default */
+#define FB_MAXSCALE 4
+#define FB_DEFAULTFPS 60       /* Screen updates a second, at most */
+#define FB_MAXPANES 32         /* Receive panes, at most */
 
-#include "usbkeyboard.h"
+/* Brings back older lines for the scrollback; see fbscrollback() */
+typedef int (*fbolder_fn)(int, int);
 
 extern int fbopen(void);
+extern int fbopen_surface(const char *, int);
+extern int fbcols(void);
+extern int fbrows(void);
+extern void fbcolors(uint32_t, uint32_t);
+extern int fbsetfont(const char *);
+extern void fbputcode(uint32_t, int, int);
 extern void fbputchar(char, int, int);
 extern void fbputs(const char *, int, int);
 extern void fbclear(void);
-extern char hex2ascii(int hex);
-extern char keyHandler(struct usb_keyboard_packet *packet);
+extern void fbflush(void);
+extern int fbvsync(int);
+extern int fbframems(const char *);
+extern int fbdump(const char *);
 extern void tok64(char **, char *, char *, int *);
 extern void fbclearrow(int);
 extern void fbclearreceive(void);
 extern void print_to_screen(const char*, int*, int);
+extern int fbpanes(int);
+extern int fbpanetitle(int);
+extern int fbpanerows(int);
+extern void print_span(int, const char *, int);
+extern void print_end(int);
+extern void print_scroll(int, int);
+extern int print_older(int, const char *, int);
+extern void fbscrollback(fbolder_fn);
+extern void print_search(int, const char *, int);
+extern void print_found(const char *, int);
 
 #endif
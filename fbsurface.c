@@ -0,0 +1,192 @@
+/*
+ * Framebuffer surfaces: the device itself, or memory standing in for it
+ */
+#include "fbsurface.h"
+#include "fbputchar.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#define FBDEV "/dev/fb0"
+
+static int devicepan(struct fbsurface *s)
+{
+  return ioctl(s->fd, FBIOPAN_DISPLAY, &s->var);
+}
+
+/* Nothing to do: the offset is all there is to a memory display */
+static int memorypan(struct fbsurface *s)
+{
+  return 0;
+}
+
+static int devicevsync(struct fbsurface *s)
+{
+  __u32 screen = 0;
+
+  return ioctl(s->fd, FBIO_WAITFORVSYNC, &screen);
+}
+
+static int memoryvsync(struct fbsurface *s)
+{
+  return -1;
+}
+
+static int opendevice(struct fbsurface *s, const char *path)
+{
+  if ( (s->fd = open(path, O_RDWR)) == -1 ) return FBOPEN_DEV;
+
+  if (ioctl(s->fd, FBIOGET_FSCREENINFO, &s->fix)) /* Get fixed info about fb */
+    return FBOPEN_FSCREENINFO;
+
+  if (ioctl(s->fd, FBIOGET_VSCREENINFO, &s->var)) /* Get varying info about fb */
+    return FBOPEN_VSCREENINFO;
+
+  if (s->var.bits_per_pixel != 16 && s->var.bits_per_pixel != 24 &&
+      s->var.bits_per_pixel != 32) return FBOPEN_BPP; /* Unexpected */
+
+  s->mem = mmap(0, s->fix.smem_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED, s->fd, 0);
+  if (s->mem == MAP_FAILED) return FBOPEN_MMAP;
+
+  s->pan = devicepan;
+  s->vsync = devicevsync;
+  return 0;
+}
+
+/*
+ * Fill in the screen info of a surface from a size such as "1024x768",
+ * "1024x768x1536" or "1024x768@16", or the default size if there is
+ * none.  16bpp is RGB565; 24 and 32bpp are RGB with red highest.
+ */
+static int fakeinfo(struct fbsurface *s, const char *size)
+{
+  unsigned xres = FBSURFACE_XRES, yres = FBSURFACE_YRES, vyres = 0;
+  unsigned bpp = 32;
+  const char *at;
+
+  if (size != NULL && sscanf(size, "%ux%ux%u", &xres, &yres, &vyres) < 2)
+    return FBOPEN_SURFACE;
+  if (size != NULL && (at = strchr(size, '@')) != NULL &&
+      sscanf(at + 1, "%u", &bpp) != 1)
+    return FBOPEN_SURFACE;
+  if (vyres < yres) vyres = yres;
+  if (xres == 0 || yres == 0) return FBOPEN_SURFACE;
+
+  memset(&s->var, 0, sizeof(s->var));
+  memset(&s->fix, 0, sizeof(s->fix));
+  s->var.xres = s->var.xres_virtual = xres;
+  s->var.yres = yres;
+  s->var.yres_virtual = vyres;
+  s->var.bits_per_pixel = bpp;
+  switch (bpp) {
+  case 16:
+    s->var.red.offset = 11;
+    s->var.green.offset = 5;
+    s->var.red.length = s->var.blue.length = 5;
+    s->var.green.length = 6;
+    break;
+  case 24:
+  case 32:
+    s->var.red.offset = 16;
+    s->var.green.offset = 8;
+    s->var.red.length = s->var.green.length = s->var.blue.length = 8;
+    break;
+  default:
+    return FBOPEN_BPP;
+  }
+  s->fix.line_length = xres * bpp / 8;
+  s->fix.smem_len = s->fix.line_length * vyres;
+  s->pan = memorypan;
+  s->vsync = memoryvsync;
+  return 0;
+}
+
+static int openmemory(struct fbsurface *s, const char *size)
+{
+  int err;
+
+  if ( (err = fakeinfo(s, size)) != 0 ) return err;
+  s->fd = -1;
+  if ( (s->mem = calloc(1, s->fix.smem_len)) == NULL ) return FBOPEN_NOMEM;
+  return 0;
+}
+
+/* spec is "path" or "path:size" */
+static int openfile(struct fbsurface *s, const char *spec)
+{
+  char path[256];
+  const char *size = strchr(spec, ':');
+  int err, n = size != NULL ? size - spec : (int) strlen(spec);
+
+  if (n == 0 || n >= (int) sizeof(path)) return FBOPEN_SURFACE;
+  memcpy(path, spec, n);
+  path[n] = 0;
+  if ( (err = fakeinfo(s, size != NULL ? size + 1 : NULL)) != 0 ) return err;
+
+  if ( (s->fd = open(path, O_RDWR | O_CREAT, 0644)) == -1 ) return FBOPEN_DEV;
+  if (ftruncate(s->fd, s->fix.smem_len)) return FBOPEN_MMAP;
+  s->mem = mmap(0, s->fix.smem_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED, s->fd, 0);
+  if (s->mem == MAP_FAILED) return FBOPEN_MMAP;
+  return 0;
+}
+
+/*
+ * Open the surface named by spec, or /dev/fb0 if spec is NULL.  Returns
+ * 0 on success or one of the FBOPEN_... return codes.
+ */
+int fbsurface_open(struct fbsurface *s, const char *spec)
+{
+  if (spec == NULL || *spec == 0) return opendevice(s, FBDEV);
+  if (strncmp(spec, "mem:", 4) == 0) return openmemory(s, spec + 4);
+  if (strcmp(spec, "mem") == 0) return openmemory(s, NULL);
+  if (strncmp(spec, "file:", 5) == 0) return openfile(s, spec + 5);
+  return opendevice(s, spec);
+}
+
+/* A colour component of a pixel, scaled to 0-255 */
+static unsigned char component(uint32_t pixel, const struct fb_bitfield *f)
+{
+  uint32_t max = (1u << f->length) - 1;
+
+  return ((pixel >> f->offset) & max) * 255 / max;
+}
+
+/*
+ * Write the visible part of the surface to path as a binary PPM.
+ * Returns 0 on success or -1 if the file could not be written.
+ */
+int fbsurface_ppm(const struct fbsurface *s, const char *path)
+{
+  FILE *f;
+  unsigned x, y, bytes = s->var.bits_per_pixel / 8;
+  uint32_t pixel = 0;
+  const unsigned char *line;
+  unsigned char rgb[3];
+
+  if ( (f = fopen(path, "wb")) == NULL ) return -1;
+  fprintf(f, "P6\n%u %u\n255\n", s->var.xres, s->var.yres);
+  for (y = 0 ; y < s->var.yres ; y++) {
+    line = s->mem + (s->var.yoffset + y) * s->fix.line_length +
+      s->var.xoffset * bytes;
+    for (x = 0 ; x < s->var.xres ; x++) {
+      memcpy(&pixel, line + x * bytes, bytes); /* Little-endian */
+      rgb[0] = component(pixel, &s->var.red);
+      rgb[1] = component(pixel, &s->var.green);
+      rgb[2] = component(pixel, &s->var.blue);
+      fwrite(rgb, 1, 3, f);
+    }
+  }
+  if (ferror(f)) {
+    fclose(f);
+    return -1;
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,36 @@
+#ifndef _FBSURFACE_H
+#define _FBSURFACE_H
+
+#include <linux/fb.h>
+
+#define FBSURFACE_XRES 1024  /* Default size of a memory or file surface */
+#define FBSURFACE_YRES 768
+
+/*
+ * Where fbputchar draws: the framebuffer device, or memory standing in
+ * for one.  Named by a string:
+ *
+ *   /dev/fb1                    a framebuffer device (the default is /dev/fb0)
+ *   mem:1024x768                anonymous memory
+ *   file:frame.raw:1024x768     a file, mapped shared, so another
+ *                               process can watch it
+ *
+ * A size may have a third number, the virtual height, e.g.
+ * mem:1024x768x1536 to give fbputchar room to flip pages, and may end
+ * with the bits per pixel, e.g. mem:1920x1080@16 for RGB565; the
+ * default is 32.  Memory and file surfaces pan by just recording the
+ * offset, and have no vertical blank to wait for.
+ */
+struct fbsurface {
+  struct fb_var_screeninfo var;
+  struct fb_fix_screeninfo fix;
+  unsigned char *mem;            /* smem_len bytes: the whole virtual screen */
+  int fd;                        /* -1 for memory */
+  int (*pan)(struct fbsurface *); /* Show var.yoffset; 0 on success */
+  int (*vsync)(struct fbsurface *); /* Wait for vertical blank; -1 if can't */
+};
+
+extern int fbsurface_open(struct fbsurface *, const char *);
+extern int fbsurface_ppm(const struct fbsurface *, const char *);
+
+#endif
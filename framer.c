@@ -0,0 +1,94 @@
+/*
+ * Newline-delimited message framing for the receive path
+ */
+#include "framer.h"
+
+#include <string.h>
+#include <sys/uio.h>
+
+void framer_init(struct framer *f)
+{
+  f->head = f->scan = f->tail = 0;
+}
+
+/*
+ * Hand the bytes from head up to (not including) end to fn, dropping a
+ * carriage return just before the newline.
+ */
+static void deliver(struct framer *f, unsigned long end, framer_fn fn,
+		    void *arg)
+{
+  unsigned long at = f->head % FRAMER_SIZE;
+  int len = end - f->head;
+  int alen = at + len <= FRAMER_SIZE ? len : FRAMER_SIZE - at;
+  int blen = len - alen;
+
+  if (blen > 0 && f->buf[blen - 1] == '\r') blen--;
+  else if (blen == 0 && alen > 0 && f->buf[at + alen - 1] == '\r') alen--;
+
+  fn(f->buf + at, alen, f->buf, blen, arg);
+  f->head = end;
+}
+
+/*
+ * Deliver every complete message read so far
+ */
+static void scan(struct framer *f, framer_fn fn, void *arg)
+{
+  unsigned long at, n;
+  char *nl;
+
+  while (f->scan < f->tail) {
+    at = f->scan % FRAMER_SIZE;
+    n = f->tail - f->scan;
+    if (at + n > FRAMER_SIZE) n = FRAMER_SIZE - at;
+
+    if ((nl = memchr(f->buf + at, '\n', n)) == NULL) {
+      f->scan += n;
+      continue;
+    }
+    f->scan += nl - (f->buf + at);
+    deliver(f, f->scan, fn, arg);
+    f->head = ++f->scan; /* Skip the newline */
+  }
+
+  /* No newline in a full buffer: the message is as long as it gets */
+  if (f->tail - f->head == FRAMER_SIZE) deliver(f, f->tail, fn, arg);
+}
+
+/*
+ * Read as much as fits from fd and call fn for each message completed.
+ * Returns what read() would: the number of bytes read, 0 at end of
+ * file, or -1 with errno set.
+ */
+int framer_read(struct framer *f, int fd, framer_fn fn, void *arg)
+{
+  struct iovec iov[2];
+  unsigned long at = f->tail % FRAMER_SIZE;
+  unsigned long space = FRAMER_SIZE - (f->tail - f->head);
+  int niov = 1;
+  ssize_t n;
+
+  iov[0].iov_base = f->buf + at;
+  iov[0].iov_len = at + space <= FRAMER_SIZE ? space : FRAMER_SIZE - at;
+  if (iov[0].iov_len < space) {
+    iov[1].iov_base = f->buf;
+    iov[1].iov_len = space - iov[0].iov_len;
+    niov = 2;
+  }
+
+  if ((n = readv(fd, iov, niov)) <= 0) return n;
+  f->tail += n;
+  scan(f, fn, arg);
+  return n;
+}
+
+/*
+ * Deliver whatever is left of an unterminated message, e.g. at end of
+ * file.
+ */
+void framer_flush(struct framer *f, framer_fn fn, void *arg)
+{
+  if (f->tail > f->head) deliver(f, f->tail, fn, arg);
+  f->scan = f->head;
+}
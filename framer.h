@@ -0,0 +1,27 @@
+#ifndef _FRAMER_H
+#define _FRAMER_H
+
+#define FRAMER_SIZE 65536  /* Bytes buffered; also the longest message */
+
+/*
+ * Splits a byte stream into newline-terminated messages.  Bytes are
+ * read straight into a ring buffer and messages are handed out where
+ * they lie, so one that wraps around the end of the ring comes out as
+ * two spans.  A message cut short by a read is kept until the rest of
+ * it arrives.
+ */
+struct framer {
+  unsigned long head;  /* First byte of the oldest incomplete message */
+  unsigned long scan;  /* Where to resume looking for a newline */
+  unsigned long tail;  /* One past the last byte read */
+  char buf[FRAMER_SIZE];
+};
+
+/* Called once per message with its two spans (the second may be empty) */
+typedef void (*framer_fn)(const char *, int, const char *, int, void *);
+
+extern void framer_init(struct framer *);
+extern int framer_read(struct framer *, int, framer_fn, void *);
+extern void framer_flush(struct framer *, framer_fn, void *);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Scrollback history: a ring of wrapped lines, allocated as it fills
+ */
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Make room for nlines lines of cols characters.  Returns 0 on
+ * success, -1 if the memory could not be allocated.  Numbering starts
+ * at nlines, so there are always sequence numbers left for
+ * history_prepend().
+ */
+int history_init(struct history *h, int nlines, int cols)
+{
+  h->nlines = nlines;
+  h->cols = cols;
+  history_clear(h);
+  h->blocks = calloc((nlines + HISTORY_BLOCK - 1) / HISTORY_BLOCK,
+		     sizeof(*h->blocks));
+  return h->blocks == NULL ? -1 : 0;
+}
+
+/*
+ * Forget every line
+ */
+void history_clear(struct history *h)
+{
+  h->first = h->end = h->nlines;
+  h->open = 0;
+}
+
+/*
+ * The block holding the line in slot, allocated if it has not been
+ * yet.  NULL if it could not be.
+ */
+static struct history_block *getblock(struct history *h, int slot)
+{
+  struct history_block **b = &h->blocks[slot / HISTORY_BLOCK];
+
+  if (*b == NULL)
+    *b = calloc(1, sizeof(**b) +
+		(size_t) HISTORY_BLOCK * h->cols * sizeof((*b)->text[0]));
+  return *b;
+}
+
+/*
+ * Add n characters to the line being written, wrapping onto new lines
+ * every h->cols characters.  A new line overwrites the oldest one
+ * once the ring is full.  Text is dropped if there is no memory left
+ * for its line.
+ */
+void history_write(struct history *h, const uint32_t *s, int n)
+{
+  struct history_block *b;
+  int slot, chunk;
+
+  while (n > 0) {
+    if (h->open == h->cols) history_endline(h);
+    if (h->open == 0 && h->end - h->first == (unsigned long) h->nlines)
+      h->first++; /* About to be overwritten */
+
+    slot = h->end % h->nlines;
+    chunk = h->cols - h->open < n ? h->cols - h->open : n;
+    if ( (b = getblock(h, slot)) != NULL ) {
+      memcpy(b->text + (slot % HISTORY_BLOCK) * h->cols + h->open, s,
+	     chunk * sizeof(*s));
+      h->open += chunk;
+    }
+    s += chunk;
+    n -= chunk;
+  }
+}
+
+/*
+ * Finish the line being written, if anything has been written to it
+ */
+void history_endline(struct history *h)
+{
+  int slot = h->end % h->nlines;
+
+  if (h->open == 0) return;
+  h->blocks[slot / HISTORY_BLOCK]->len[slot % HISTORY_BLOCK] = h->open;
+  h->end++;
+  h->open = 0;
+}
+
+/*
+ * Put n characters, wrapped the same way, in front of the oldest line.
+ * Returns the number of lines added, or -1 if there is no room for all
+ * of them; lines are never overwritten to make room.
+ */
+int history_prepend(struct history *h, const uint32_t *s, int n)
+{
+  int lines = (n + h->cols - 1) / h->cols, i, slot, chunk;
+  struct history_block *b;
+
+  if (h->end - h->first + (h->open > 0) + lines > (unsigned long) h->nlines)
+    return -1;
+  for (i = 1 ; i <= lines ; i++)
+    if (getblock(h, (h->first - i) % h->nlines) == NULL) return -1;
+
+  for (i = lines - 1 ; i >= 0 ; i--) {
+    slot = --h->first % h->nlines;
+    b = h->blocks[slot / HISTORY_BLOCK];
+    chunk = n - i * h->cols < h->cols ? n - i * h->cols : h->cols;
+    memcpy(b->text + (slot % HISTORY_BLOCK) * h->cols, s + i * h->cols,
+	   chunk * sizeof(*s));
+    b->len[slot % HISTORY_BLOCK] = chunk;
+  }
+  return lines;
+}
+
+/*
+ * Return the text of line seq and store its length in *n, or return
+ * NULL if the line has not been written yet or was overwritten.
+ */
+const uint32_t *history_line(const struct history *h, unsigned long seq, int *n)
+{
+  struct history_block *b;
+  int slot;
+
+  if (seq < h->first || seq >= h->end) return NULL;
+  slot = seq % h->nlines;
+  b = h->blocks[slot / HISTORY_BLOCK];
+  *n = b->len[slot % HISTORY_BLOCK];
+  return b->text + (slot % HISTORY_BLOCK) * h->cols;
+}
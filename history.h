@@ -0,0 +1,38 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_LINES 4096   /* Lines kept by default */
+#define HISTORY_BLOCK 64     /* Lines allocated at a time */
+
+/*
+ * A bounded ring of wrapped lines.  Every line ever appended has a
+ * sequence number; the oldest ones are overwritten once the ring is
+ * full.  Older lines may also be put back in front of the oldest, as
+ * long as there is room.  The lines are allocated HISTORY_BLOCK at a
+ * time, the first time one of them is written, so a history that has
+ * seen little text takes little memory whatever its capacity.
+ */
+struct history_block {
+  unsigned short len[HISTORY_BLOCK];
+  uint32_t text[];              /* HISTORY_BLOCK lines of cols codepoints */
+};
+
+struct history {
+  int nlines;                   /* Capacity */
+  int cols;                     /* Characters in one wrapped line */
+  unsigned long first;          /* Sequence number of the oldest line kept */
+  unsigned long end;            /* Sequence number of the next line */
+  int open;                     /* Characters in the line being written */
+  struct history_block **blocks; /* Each NULL until written to */
+};
+
+extern int history_init(struct history *, int, int);
+extern void history_clear(struct history *);
+extern void history_write(struct history *, const uint32_t *, int);
+extern void history_endline(struct history *);
+extern int history_prepend(struct history *, const uint32_t *, int);
+extern const uint32_t *history_line(const struct history *, unsigned long, int *);
+
+#endif
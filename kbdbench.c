@@ -0,0 +1,322 @@
+/*
+ * Keyboard benchmark: recorded typing replayed through the client's
+ * input path, from USB reports to the entry on a memory surface
+ *
+ * Usage: kbdbench [-r] [-n keys] [-w file] [recording ...]
+ *
+ * Replays each recording (made with KBDRECORD=file ./lab2) through the
+ * keyboard, the keymap and the entry editor the way the client does,
+ * drawing the entry with the render thread and flushing after every
+ * key.  Keys go to the entry through editor_enter(), as in the client,
+ * and Enter clears it as sending does; the keys that page, search or
+ * change rooms are left out.  The reports go in as fast as
+ * they can be handled, or with -r at the times they were recorded.
+ * Reports keys handled per second, the time from each report to its
+ * key being handled and to the entry being on the screen (see
+ * stats.h), and whether the entry ended up byte for byte as it was
+ * when the session was recorded.
+ *
+ * With no recordings, a made-up session of -n keystrokes (default
+ * 20000) is recorded and replayed; -w file only records it.  FBSURFACE,
+ * FBSCALE, FBFONT and KEYMAP work as they do for the client.
+ */
+#include "fbputchar.h"
+#include "render.h"
+#include "eventloop.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "editor.h"
+#include "kbdrecord.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#define SESSION_MESSAGE 120  /* Characters typed before Enter, at most */
+#define SESSION_KEYS 0x200   /* keymap_key() values typed */
+
+static struct editor entry;
+static struct stats_hist usbkey, keypixel;
+static long long keyarrival;
+static unsigned long keys;
+static atomic_ulong drawn;
+
+/* Called by the render thread once the key that arrived at arg is shown */
+static void pixel_f(void *arg)
+{
+  stats_record(&keypixel, stats_now() - (intptr_t) arg, 1);
+  atomic_fetch_add(&drawn, 1);
+}
+
+/* Every message is sent at once */
+static int send_f(const char *text, int len, void *ignored)
+{
+  return 0;
+}
+
+/* As in the client, short of the keys that need the rest of it */
+static void key_f(uint8_t keycode, uint8_t modifiers, int state)
+{
+  int key;
+
+  if (state == KEY_RELEASED) return;
+  if (state == KEY_REPEATED) keyarrival = stats_now();
+  if ( (key = keymap_key(keycode, modifiers)) == KEY_NONE ) return;
+  stats_record(&usbkey, stats_now() - keyarrival, 1);
+
+  editor_enter(&entry, key, send_f, NULL);
+  editor_draw(&entry);
+  keys++;
+  render_call(pixel_f, (void *) (intptr_t) keyarrival);
+  render_flush();
+}
+
+static void report_f(const struct usb_keyboard_packet *report)
+{
+  keyarrival = stats_now();
+  keyboard_report(report);
+}
+
+static void done_f(struct kbdreplay *p)
+{
+  evloop_stop();
+}
+
+/*
+ * A made-up typing session
+ */
+static uint8_t codeof[SESSION_KEYS], shiftof[SESSION_KEYS]; /* Typing each key */
+static struct usb_keyboard_packet down;   /* Keys held */
+static long long clock_ms;
+static char text[EDITOR_SIZE];            /* What the entry should hold */
+static int textlen, cursor;
+
+/* Find the key and shift that type each character, in this layout */
+static void learnkeys(void)
+{
+  int code, shift, key;
+
+  for (shift = 1 ; shift >= 0 ; shift--)
+    for (code = 0x53 ; code > 0 ; code--) {
+      key = keymap_key(code, shift ? USB_LSHIFT : 0);
+      if (key > 0 && key < SESSION_KEYS) {
+	codeof[key] = code;
+	shiftof[key] = shift ? USB_LSHIFT : 0;
+      }
+    }
+}
+
+static void send_report(void)
+{
+  kbdrecord_report(&down, clock_ms * 1000000);
+}
+
+/* Change the entry the way the editor will for key */
+static void expect(int key)
+{
+  switch (key) {
+  case '\n': textlen = cursor = 0; break;
+  case '\b':
+    if (cursor == 0) break;
+    memmove(text + cursor - 1, text + cursor, textlen - cursor);
+    textlen--;
+    cursor--;
+    break;
+  case KEY_LEFT: if (cursor > 0) cursor--; break;
+  case KEY_END: cursor = textlen; break;
+  default:
+    memmove(text + cursor + 1, text + cursor, textlen - cursor);
+    text[cursor++] = key;
+    textlen++;
+    break;
+  }
+}
+
+/* Press and release key, held for hold ms, then wait gap ms */
+static void stroke(int key, int hold, int gap)
+{
+  int repeats = hold >= KEYBOARD_DELAY ?
+    (hold - KEYBOARD_DELAY) / KEYBOARD_RATE + 1 : 0;
+
+  down.modifiers = shiftof[key];
+  down.keycode[0] = codeof[key];
+  send_report();
+  clock_ms += hold;
+  memset(&down, 0, sizeof(down));
+  send_report();
+  clock_ms += gap;
+  for (expect(key) ; repeats-- > 0 ; expect(key))
+    ;
+}
+
+/*
+ * Record strokes keystrokes of typing to path: words with the odd
+ * capital and typo put right, some held down long enough to repeat,
+ * some fixed up by moving back, and a message sent with Enter now and
+ * then
+ */
+static int record_session(const char *path, long strokes)
+{
+  static const char *words[] = {
+    "the", "lab", "is", "due", "Friday", "who", "has", "a", "working",
+    "keyboard", "driver?", "my", "framebuffer", "shows", "garbage", "try",
+    "rebooting", "the", "board", "(again)", "did", "you", "flash", "it!",
+  };
+  const char *w;
+  long n = 0;
+  int i;
+
+  learnkeys();
+  if (kbdrecord_open(path) < 0) return -1;
+  textlen = cursor = 0;
+  clock_ms = 0;
+  srand(1);
+  while (n < strokes) {
+    w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+    if (textlen + strlen(w) + 2 > SESSION_MESSAGE) {
+      stroke('\n', 60, 300);
+      n++;
+      continue;
+    }
+
+    /* Now and then go back a few characters and put a word there */
+    if (textlen > 10 && rand() % 30 == 0) {
+      for (i = 1 + rand() % 5 ; i > 0 ; i--, n++)
+	stroke(KEY_LEFT, 50, 80);
+      for ( ; *w ; w++, n++)
+	stroke(*w, 40 + rand() % 40, 60 + rand() % 120);
+      stroke(' ', 50, 90);
+      stroke(KEY_END, 50, 120);
+      n += 2;
+      continue;
+    }
+
+    for ( ; *w ; w++, n++) {
+      if (rand() % 40 == 0) {           /* A typo, put right */
+	stroke('a' + rand() % 26, 40, 150);
+	stroke('\b', 60, 100);
+	n += 2;
+      }
+      stroke(*w, rand() % 80 == 0 ? 600 + rand() % 400 : 40 + rand() % 40,
+	     60 + rand() % 120);
+    }
+    stroke(' ', 50, 90);
+    n++;
+  }
+  kbdrecord_close(text, textlen);
+  return 0;
+}
+
+/*
+ * Replay one recording, printing what it took.  Returns 1 if the entry
+ * ended up as recorded (or nothing was recorded to check against), else
+ * 0; -1 if it could not be replayed.
+ */
+static int bench(const char *path, int realtime)
+{
+  struct kbdreplay replay;
+  const char *got;
+  long long start, end;
+  unsigned long before = keys;
+  int err, len, same;
+
+  if ( (err = kbdreplay_load(&replay, path)) < 0 ) {
+    fprintf(stderr, "Error: Could not read the recording %s: %d\n", path, err);
+    return -1;
+  }
+  editor_clear(&entry);
+  keyboard_reset();
+  if (kbdreplay_start(&replay, !realtime, report_f, done_f) < 0) {
+    fprintf(stderr, "Error: Could not replay %s\n", path);
+    kbdreplay_free(&replay);
+    return -1;
+  }
+  start = stats_now();
+  evloop_run();
+
+  /* Until the last key is on the screen */
+  while (atomic_load(&drawn) < keys)
+    usleep(100);
+  end = stats_now();
+
+  got = editor_text(&entry, &len);
+  same = replay.entry == NULL ||
+    (len == replay.entrylen && memcmp(got, replay.entry, len) == 0);
+  printf("kbdbench: %s: %u reports, %lu keys in %.2f s, %.0f keys/s, entry %s\n",
+	 path, replay.count, keys - before, (end - start) / 1e9,
+	 (keys - before) / ((end - start) / 1e9 + 1e-9),
+	 replay.entry == NULL ? "not recorded" : same ? "matches" : "DIFFERS");
+  kbdreplay_free(&replay);
+  return same;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *spec = getenv("FBSURFACE"), *font = getenv("FBFONT");
+  const char *layout = getenv("KEYMAP"), *out = NULL;
+  int scale = getenv("FBSCALE") ? atoi(getenv("FBSCALE")) : FB_DEFAULTSCALE;
+  char session[] = "/tmp/kbdbench.XXXXXX";
+  long strokes = 20000;
+  int opt, realtime = 0, fd, failed = 0, i;
+
+  while ( (opt = getopt(argc, argv, "rn:w:")) != -1 )
+    switch (opt) {
+    case 'r': realtime = 1; break;
+    case 'n': strokes = atol(optarg); break;
+    case 'w': out = optarg; break;
+    default:
+      fprintf(stderr, "Usage: %s [-r] [-n keys] [-w file] [recording ...]\n",
+	      argv[0]);
+      exit(1);
+    }
+  if (layout != NULL && keymap_select(layout) < 0) {
+    fprintf(stderr, "Error: Unknown keyboard layout \"%s\"\n", layout);
+    exit(1);
+  }
+
+  /* The made-up session, if there are no recordings to replay */
+  if (out != NULL || optind == argc) {
+    if (out == NULL) {
+      if ( (fd = mkstemp(session)) < 0 ) {
+	perror(session);
+	exit(1);
+      }
+      close(fd);
+    }
+    if (record_session(out != NULL ? out : session, strokes) < 0) {
+      fprintf(stderr, "Error: Could not write the session\n");
+      exit(1);
+    }
+    if (out != NULL) return 0;
+  }
+
+  if (font != NULL && fbsetfont(font) != 0) {
+    fprintf(stderr, "Error: Could not load the font %s\n", font);
+    exit(1);
+  }
+  if (fbopen_surface(spec != NULL ? spec : "mem", scale) != 0) {
+    fprintf(stderr, "Error: Could not open the surface\n");
+    exit(1);
+  }
+  fbclear();
+  stats_register(&usbkey, "usb-key");
+  stats_register(&keypixel, "key");
+  if (evloop_init() < 0 || render_start() < 0 || keyboard_init(key_f) < 0 ||
+      editor_init(&entry, fbrows() - 2, 2, fbcols()) < 0) {
+    fprintf(stderr, "Error: Could not set up the client\n");
+    exit(1);
+  }
+
+  if (optind == argc)
+    failed = bench(session, realtime) != 1;
+  for (i = optind ; i < argc ; i++)
+    failed |= bench(argv[i], realtime) != 1;
+  if (optind == argc) unlink(session);
+
+  render_stop();
+  stats_print(stdout);
+  return failed;
+}
@@ -0,0 +1,186 @@
+/*
+ * Keyboard reports recorded to a file with the time each arrived, and
+ * replayed from it through the event loop
+ */
+#include "kbdrecord.h"
+#include "eventloop.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static FILE *recording;
+static long long recordstart;    /* When the first report arrived, ns */
+static uint32_t recorded;        /* Reports written */
+
+/*
+ * Start recording to the file at path, replacing what was there.
+ * Returns 0, or -1 if it cannot be written.
+ */
+int kbdrecord_open(const char *path)
+{
+  struct kbdrecord_header h;
+
+  if ( (recording = fopen(path, "wb")) == NULL ) return -1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, KBDRECORD_MAGIC, sizeof(h.magic));
+  recorded = 0;
+  if (fwrite(&h, sizeof(h), 1, recording) != 1) {
+    fclose(recording);
+    recording = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Record a report that arrived at when (see stats_now()).  Buffered;
+ * only written out in full by kbdrecord_close().
+ */
+void kbdrecord_report(const struct usb_keyboard_packet *r, long long when)
+{
+  struct kbdrecord_event e;
+
+  if (recording == NULL) return;
+  if (recorded == 0) recordstart = when;
+  memset(&e, 0, sizeof(e));
+  e.time = when - recordstart;
+  e.report = *r;
+  if (fwrite(&e, sizeof(e), 1, recording) == 1) recorded++;
+}
+
+/*
+ * Finish the recording with the len bytes of text the entry ended up
+ * holding
+ */
+void kbdrecord_close(const char *entry, int len)
+{
+  struct kbdrecord_header h;
+
+  if (recording == NULL) return;
+  fwrite(entry, 1, len, recording);
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, KBDRECORD_MAGIC, sizeof(h.magic));
+  h.events = recorded;
+  h.entrylen = len;
+  if (fseek(recording, 0, SEEK_SET) == 0)
+    fwrite(&h, sizeof(h), 1, recording);
+  fclose(recording);
+  recording = NULL;
+}
+
+/*
+ * Read the recording at path.  Returns 0, or KBDREPLAY_OPEN,
+ * KBDREPLAY_FORMAT or KBDREPLAY_NOMEM.
+ */
+int kbdreplay_load(struct kbdreplay *p, const char *path)
+{
+  struct kbdrecord_header h;
+  FILE *f;
+  long size;
+  int err = 0;
+
+  memset(p, 0, sizeof(*p));
+  p->timer = -1;
+  if ( (f = fopen(path, "rb")) == NULL ) return KBDREPLAY_OPEN;
+  if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) < 0) {
+    fclose(f);
+    return KBDREPLAY_OPEN;
+  }
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.magic, KBDRECORD_MAGIC, sizeof(h.magic)) != 0) {
+    fclose(f);
+    return KBDREPLAY_FORMAT;
+  }
+  size -= sizeof(h);
+
+  /* Never closed: as many whole reports as there are, and no entry */
+  if (h.events == 0) {
+    h.events = size / sizeof(struct kbdrecord_event);
+    h.entrylen = 0;
+  } else if ((unsigned long) size !=
+	     h.events * sizeof(struct kbdrecord_event) + h.entrylen) {
+    fclose(f);
+    return KBDREPLAY_FORMAT;
+  } else if ( (p->entry = malloc(h.entrylen + 1)) == NULL )
+    err = KBDREPLAY_NOMEM;
+
+  p->count = h.events;
+  if (err == 0 &&
+      (p->events = malloc((h.events + 1) * sizeof(*p->events))) == NULL)
+    err = KBDREPLAY_NOMEM;
+  if (err == 0 &&
+      (fread(p->events, sizeof(*p->events), p->count, f) != p->count ||
+       (p->entry != NULL && fread(p->entry, 1, h.entrylen, f) != h.entrylen)))
+    err = KBDREPLAY_OPEN;
+  fclose(f);
+  if (err < 0) {
+    kbdreplay_free(p);
+    return err;
+  }
+  p->entrylen = h.entrylen;
+  return 0;
+}
+
+/*
+ * Hand the reports that are due to the replay's function: every one
+ * going fast, else the ones whose time has come, waiting for the next
+ */
+static void replay_f(int fd, uint32_t events, void *arg)
+{
+  struct kbdreplay *p = arg;
+  const struct kbdrecord_event *e;
+  long long elapsed = stats_now() - p->start;
+
+  for ( ; p->next < p->count ; p->next++) {
+    e = &p->events[p->next];
+    if (p->fast)
+      keyboard_advance(e->time / 1000000);
+    else if (e->time > elapsed) {
+      evloop_arm(p->timer, (e->time - elapsed) / 1000000 + 1, 0);
+      return;
+    }
+    p->fn(&e->report);
+  }
+  if (p->done != NULL) p->done(p);
+}
+
+/*
+ * Start replaying: fn is called from the event loop with each report,
+ * at the times they were recorded, or straight away if fast is set,
+ * and done once they have all been.  Returns 0, or KBDREPLAY_NOMEM if
+ * the timer could not be created.
+ */
+int kbdreplay_start(struct kbdreplay *p, int fast, kbdreplay_fn fn,
+		    kbdreplay_done_fn done)
+{
+  p->next = 0;
+  p->fast = fast;
+  p->fn = fn;
+  p->done = done;
+  if (p->timer < 0 && (p->timer = evloop_timer(replay_f, p)) < 0)
+    return KBDREPLAY_NOMEM;
+  p->start = stats_now();
+  evloop_arm(p->timer, 1, 0);
+  return 0;
+}
+
+/*
+ * Stop replaying and forget the recording
+ */
+void kbdreplay_free(struct kbdreplay *p)
+{
+  if (p->timer >= 0) {
+    evloop_del(p->timer);
+    close(p->timer);
+    p->timer = -1;
+  }
+  free(p->events);
+  free(p->entry);
+  p->events = NULL;
+  p->entry = NULL;
+  p->count = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef _KBDRECORD_H
+#define _KBDRECORD_H
+
+#include <stdint.h>
+#include "keyboard.h"
+
+#define KBDRECORD_MAGIC "kbdrec1\n"
+
+#define KBDREPLAY_OPEN -1    /* Couldn't open or read the recording */
+#define KBDREPLAY_FORMAT -2  /* Not a recording */
+#define KBDREPLAY_NOMEM -3   /* Couldn't allocate it, or the timer */
+
+/*
+ * Keyboard sessions recorded to a file and played back, so the input
+ * path can be exercised and measured without a keyboard.
+ *
+ * A recording is a struct kbdrecord_header, one struct kbdrecord_event
+ * for each report as the keyboard sent it, and the text of the entry
+ * when recording stopped, so a replay can be checked against it.  The
+ * header's counts are only filled in by kbdrecord_close(); a recording
+ * cut short still replays, but cannot be checked.
+ *
+ * A replay hands the reports to the same function the USB keyboard
+ * does, from a timer in the event loop, either at the times they were
+ * recorded or all at once.  All at once, the keyboard runs on the
+ * recording's clock (see keyboard_advance()), so held keys repeat as
+ * many times as they did.
+ */
+struct kbdrecord_header {
+  char magic[8];
+  uint32_t events;       /* Reports recorded, or 0 if never closed */
+  uint32_t entrylen;     /* Bytes of entry text after them */
+};
+
+struct kbdrecord_event {
+  int64_t time;          /* ns since the first report */
+  struct usb_keyboard_packet report;
+};
+
+/* Called with each report replayed */
+typedef void (*kbdreplay_fn)(const struct usb_keyboard_packet *);
+
+struct kbdreplay;
+typedef void (*kbdreplay_done_fn)(struct kbdreplay *);
+
+struct kbdreplay {
+  struct kbdrecord_event *events;
+  unsigned count;
+  char *entry;           /* The entry at the end, or NULL if unknown */
+  int entrylen;
+
+  unsigned next;         /* Event to replay next */
+  int fast;              /* All at once, rather than in real time? */
+  int timer;
+  long long start;       /* When the replay started, ns */
+  kbdreplay_fn fn;
+  kbdreplay_done_fn done;
+};
+
+extern int kbdrecord_open(const char *);
+extern void kbdrecord_report(const struct usb_keyboard_packet *, long long);
+extern void kbdrecord_close(const char *, int);
+
+extern int kbdreplay_load(struct kbdreplay *, const char *);
+extern int kbdreplay_start(struct kbdreplay *, int, kbdreplay_fn,
+			   kbdreplay_done_fn);
+extern void kbdreplay_free(struct kbdreplay *);
+
+#endif
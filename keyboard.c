@@ -0,0 +1,118 @@
+/*
+ * Turns keyboard reports into key events.
+ *
+ * A boot protocol report lists up to six keys that are down right now.
+ * Comparing each report with the one before it tells exactly which keys
+ * went down and which came up, however fast they are typed.  The last
+ * key pressed repeats while it is held, driven by a timer in the event
+ * loop, or by keyboard_advance() when recorded reports are replayed
+ * faster than they were typed.
+ */
+#include "keyboard.h"
+#include "eventloop.h"
+
+#include <string.h>
+
+#define USB_ERROR_ROLLOVER 0x01 /* Too many keys down to report */
+
+static keyboard_fn keyfn;
+static struct usb_keyboard_packet last;  /* Previous report */
+static int repeattimer;
+static uint8_t repeatkey;                /* Key repeating, or 0 */
+static int clocked;                      /* Repeats from keyboard_advance()? */
+static long long now, repeatat;          /* Its clock and next repeat, ms */
+
+static int held(const struct usb_keyboard_packet *r, uint8_t key)
+{
+  int i;
+
+  for (i = 0 ; i < 6 ; i++)
+    if (r->keycode[i] == key) return 1;
+  return 0;
+}
+
+static void repeat(int fd, uint32_t events, void *ignored)
+{
+  if (repeatkey) keyfn(repeatkey, last.modifiers, KEY_REPEATED);
+}
+
+/*
+ * Call fn for every key event from now on.  Returns 0 on success, -1 if
+ * the repeat timer could not be created.
+ */
+int keyboard_init(keyboard_fn fn)
+{
+  keyfn = fn;
+  memset(&last, 0, sizeof(last));
+  repeatkey = 0;
+  clocked = 0;
+  repeattimer = evloop_timer(repeat, NULL);
+  return repeattimer < 0 ? -1 : 0;
+}
+
+/*
+ * Handle a report: keys that came up first, then keys that went down
+ */
+void keyboard_report(const struct usb_keyboard_packet *r)
+{
+  int i;
+  uint8_t key;
+
+  /* With too many keys down the report says nothing about which */
+  if (r->keycode[0] == USB_ERROR_ROLLOVER) return;
+
+  for (i = 0 ; i < 6 ; i++) {
+    key = last.keycode[i];
+    if (key == 0 || held(r, key)) continue;
+    if (key == repeatkey) {
+      repeatkey = 0;
+      evloop_arm(repeattimer, 0, 0);
+    }
+    keyfn(key, r->modifiers, KEY_RELEASED);
+  }
+
+  for (i = 0 ; i < 6 ; i++) {
+    key = r->keycode[i];
+    if (key == 0 || held(&last, key)) continue;
+    repeatkey = key;
+    if (clocked) repeatat = now + KEYBOARD_DELAY;
+    else evloop_arm(repeattimer, KEYBOARD_DELAY, KEYBOARD_RATE);
+    keyfn(key, r->modifiers, KEY_PRESSED);
+  }
+
+  last = *r;
+}
+
+/*
+ * Move the keyboard's clock on to ms, making the repeats the key held
+ * would have made by then.  For replaying reports on the clock they
+ * were recorded with rather than the real one: once this is called,
+ * the repeat timer is no longer used.
+ */
+void keyboard_advance(long long ms)
+{
+  if (!clocked) {
+    clocked = 1;
+    evloop_arm(repeattimer, 0, 0);
+    repeatat = ms + KEYBOARD_DELAY;
+  }
+  for ( ; repeatkey && repeatat <= ms ; repeatat += KEYBOARD_RATE)
+    keyfn(repeatkey, last.modifiers, KEY_REPEATED);
+  now = ms;
+}
+
+/*
+ * Release every key and go back to the repeat timer, e.g. when the
+ * keyboard goes away or another recording is about to be replayed
+ */
+void keyboard_reset(void)
+{
+  struct usb_keyboard_packet none;
+
+  memset(&none, 0, sizeof(none));
+  keyboard_report(&none);
+  repeatkey = 0;
+  evloop_arm(repeattimer, 0, 0);
+  clocked = 0;
+  now = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef _KEYBOARD_H
+#define _KEYBOARD_H
+
+#include <stdint.h>
+
+/* Modifier bits */
+#define USB_LCTRL  (1 << 0)
+#define USB_LSHIFT (1 << 1)
+#define USB_LALT   (1 << 2)
+#define USB_LGUI   (1 << 3)
+#define USB_RCTRL  (1 << 4)
+#define USB_RSHIFT (1 << 5)
+#define USB_RALT   (1 << 6) 
+#define USB_RGUI   (1 << 7)
+
+/* A HID boot protocol keyboard report */
+struct usb_keyboard_packet {
+  uint8_t modifiers;
+  uint8_t reserved;
+  uint8_t keycode[6];
+};
+
+/* What happened to a key */
+#define KEY_RELEASED 0
+#define KEY_PRESSED 1
+#define KEY_REPEATED 2   /* Held down long enough to repeat */
+
+#define KEYBOARD_DELAY 500  /* Milliseconds before a held key repeats */
+#define KEYBOARD_RATE 33    /* Milliseconds between repeats */
+
+/* Called with a key's usage code, the modifiers held, and what happened */
+typedef void (*keyboard_fn)(uint8_t, uint8_t, int);
+
+extern int keyboard_init(keyboard_fn);
+extern void keyboard_report(const struct usb_keyboard_packet *);
+extern void keyboard_advance(long long);
+extern void keyboard_reset(void);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Keyboard layouts: HID usage codes to characters
+ *
+ * Each layout is a list of keys giving the code a key makes on its own
+ * and with Shift.  The list is expanded at compile time into a table
+ * with a row for every combination of Ctrl, Shift and Alt, so
+ * translating a key is a single lookup.
+ */
+#include "keymap.h"
+
+#include <string.h>
+
+/* Modifier states, folded from the report's left and right bits */
+#define KEYMAP_CTRL  1
+#define KEYMAP_SHIFT 2
+#define KEYMAP_ALT   4
+#define KEYMAP_STATES 8
+
+#define MODSTATE(m) (((m) | (m) >> 4) & (KEYMAP_STATES - 1))
+
+#define ENTRY(state, code, plain, shifted) \
+  [code] = ((state) & KEYMAP_CTRL ? KEY_CTRL : 0) | \
+           ((state) & KEYMAP_ALT ? KEY_ALT : 0) | \
+           ((state) & KEYMAP_SHIFT ? (shifted) : (plain)),
+
+#define TABLE(keys) { \
+  { keys(ENTRY, 0) }, { keys(ENTRY, 1) }, { keys(ENTRY, 2) }, \
+  { keys(ENTRY, 3) }, { keys(ENTRY, 4) }, { keys(ENTRY, 5) }, \
+  { keys(ENTRY, 6) }, { keys(ENTRY, 7) } }
+
+/* Keys that are the same in every layout */
+#define COMMON_KEYS(K, s) \
+  K(s, 0x28, '\n', '\n') K(s, 0x29, KEY_ESC, KEY_ESC) \
+  K(s, 0x2a, '\b', '\b') K(s, 0x2b, '\t', '\t') K(s, 0x2c, ' ', ' ') \
+  K(s, 0x3a, KEY_F(1), KEY_F(1)) K(s, 0x3b, KEY_F(2), KEY_F(2)) \
+  K(s, 0x3c, KEY_F(3), KEY_F(3)) K(s, 0x3d, KEY_F(4), KEY_F(4)) \
+  K(s, 0x3e, KEY_F(5), KEY_F(5)) K(s, 0x3f, KEY_F(6), KEY_F(6)) \
+  K(s, 0x40, KEY_F(7), KEY_F(7)) K(s, 0x41, KEY_F(8), KEY_F(8)) \
+  K(s, 0x42, KEY_F(9), KEY_F(9)) K(s, 0x43, KEY_F(10), KEY_F(10)) \
+  K(s, 0x44, KEY_F(11), KEY_F(11)) K(s, 0x45, KEY_F(12), KEY_F(12)) \
+  K(s, 0x49, KEY_INSERT, KEY_INSERT) K(s, 0x4a, KEY_HOME, KEY_HOME) \
+  K(s, 0x4b, KEY_PGUP, KEY_PGUP) K(s, 0x4c, KEY_DELETE, KEY_DELETE) \
+  K(s, 0x4d, KEY_END, KEY_END) K(s, 0x4e, KEY_PGDN, KEY_PGDN) \
+  K(s, 0x4f, KEY_RIGHT, KEY_RIGHT) K(s, 0x50, KEY_LEFT, KEY_LEFT) \
+  K(s, 0x51, KEY_DOWN, KEY_DOWN) K(s, 0x52, KEY_UP, KEY_UP) \
+  K(s, 0x54, '/', '/') K(s, 0x55, '*', '*') K(s, 0x56, '-', '-') \
+  K(s, 0x57, '+', '+') K(s, 0x58, '\n', '\n') \
+  K(s, 0x59, '1', '1') K(s, 0x5a, '2', '2') K(s, 0x5b, '3', '3') \
+  K(s, 0x5c, '4', '4') K(s, 0x5d, '5', '5') K(s, 0x5e, '6', '6') \
+  K(s, 0x5f, '7', '7') K(s, 0x60, '8', '8') K(s, 0x61, '9', '9') \
+  K(s, 0x62, '0', '0') K(s, 0x63, '.', '.')
+
+/* Digits and their shifted symbols, shared by the US layouts */
+#define US_DIGITS(K, s) \
+  K(s, 0x1e, '1', '!') K(s, 0x1f, '2', '@') K(s, 0x20, '3', '#') \
+  K(s, 0x21, '4', '$') K(s, 0x22, '5', '%') K(s, 0x23, '6', '^') \
+  K(s, 0x24, '7', '&') K(s, 0x25, '8', '*') K(s, 0x26, '9', '(') \
+  K(s, 0x27, '0', ')')
+
+/* US QWERTY */
+#define US_KEYS(K, s) \
+  K(s, 0x04, 'a', 'A') K(s, 0x05, 'b', 'B') K(s, 0x06, 'c', 'C') \
+  K(s, 0x07, 'd', 'D') K(s, 0x08, 'e', 'E') K(s, 0x09, 'f', 'F') \
+  K(s, 0x0a, 'g', 'G') K(s, 0x0b, 'h', 'H') K(s, 0x0c, 'i', 'I') \
+  K(s, 0x0d, 'j', 'J') K(s, 0x0e, 'k', 'K') K(s, 0x0f, 'l', 'L') \
+  K(s, 0x10, 'm', 'M') K(s, 0x11, 'n', 'N') K(s, 0x12, 'o', 'O') \
+  K(s, 0x13, 'p', 'P') K(s, 0x14, 'q', 'Q') K(s, 0x15, 'r', 'R') \
+  K(s, 0x16, 's', 'S') K(s, 0x17, 't', 'T') K(s, 0x18, 'u', 'U') \
+  K(s, 0x19, 'v', 'V') K(s, 0x1a, 'w', 'W') K(s, 0x1b, 'x', 'X') \
+  K(s, 0x1c, 'y', 'Y') K(s, 0x1d, 'z', 'Z') \
+  US_DIGITS(K, s) \
+  K(s, 0x2d, '-', '_') K(s, 0x2e, '=', '+') K(s, 0x2f, '[', '{') \
+  K(s, 0x30, ']', '}') K(s, 0x31, '\\', '|') K(s, 0x33, ';', ':') \
+  K(s, 0x34, '\'', '"') K(s, 0x35, '`', '~') K(s, 0x36, ',', '<') \
+  K(s, 0x37, '.', '>') K(s, 0x38, '/', '?') \
+  COMMON_KEYS(K, s)
+
+/* US Dvorak, on a keyboard whose keys are labelled QWERTY */
+#define DVORAK_KEYS(K, s) \
+  K(s, 0x04, 'a', 'A') K(s, 0x05, 'x', 'X') K(s, 0x06, 'j', 'J') \
+  K(s, 0x07, 'e', 'E') K(s, 0x08, '.', '>') K(s, 0x09, 'u', 'U') \
+  K(s, 0x0a, 'i', 'I') K(s, 0x0b, 'd', 'D') K(s, 0x0c, 'c', 'C') \
+  K(s, 0x0d, 'h', 'H') K(s, 0x0e, 't', 'T') K(s, 0x0f, 'n', 'N') \
+  K(s, 0x10, 'm', 'M') K(s, 0x11, 'b', 'B') K(s, 0x12, 'r', 'R') \
+  K(s, 0x13, 'l', 'L') K(s, 0x14, '\'', '"') K(s, 0x15, 'p', 'P') \
+  K(s, 0x16, 'o', 'O') K(s, 0x17, 'y', 'Y') K(s, 0x18, 'g', 'G') \
+  K(s, 0x19, 'k', 'K') K(s, 0x1a, ',', '<') K(s, 0x1b, 'q', 'Q') \
+  K(s, 0x1c, 'f', 'F') K(s, 0x1d, ';', ':') \
+  US_DIGITS(K, s) \
+  K(s, 0x2d, '[', '{') K(s, 0x2e, ']', '}') K(s, 0x2f, '/', '?') \
+  K(s, 0x30, '=', '+') K(s, 0x31, '\\', '|') K(s, 0x33, 's', 'S') \
+  K(s, 0x34, '-', '_') K(s, 0x35, '`', '~') K(s, 0x36, 'w', 'W') \
+  K(s, 0x37, 'v', 'V') K(s, 0x38, 'z', 'Z') \
+  COMMON_KEYS(K, s)
+
+typedef uint16_t keytable[KEYMAP_STATES][256];
+
+static const keytable us = TABLE(US_KEYS);
+static const keytable dvorak = TABLE(DVORAK_KEYS);
+
+static const struct {
+  const char *name;
+  const keytable *table;
+} layouts[] = {
+  { "us", &us },
+  { "dvorak", &dvorak },
+};
+
+static const keytable *layout = &us;
+
+/*
+ * Translate a key pressed with the given modifiers.  Returns its
+ * character or KEY_ code, possibly with KEY_CTRL and KEY_ALT added, or
+ * KEY_NONE for keys with no meaning here.
+ */
+int keymap_key(uint8_t keycode, uint8_t modifiers)
+{
+  return (*layout)[MODSTATE(modifiers)][keycode];
+}
+
+/*
+ * Switch to the named layout.  Returns 0 on success, -1 if there is no
+ * layout by that name.
+ */
+int keymap_select(const char *name)
+{
+  unsigned i;
+
+  for (i = 0 ; i < sizeof(layouts) / sizeof(layouts[0]) ; i++)
+    if (strcmp(layouts[i].name, name) == 0) {
+      layout = layouts[i].table;
+      return 0;
+    }
+  return -1;
+}
@@ -0,0 +1,34 @@
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include <stdint.h>
+
+/*
+ * Keys are translated to ASCII where they have a character; these are
+ * the codes for the ones that do not.
+ */
+#define KEY_NONE    0
+#define KEY_ESC     27
+#define KEY_RIGHT   0x101
+#define KEY_LEFT    0x102
+#define KEY_DOWN    0x103
+#define KEY_UP      0x104
+#define KEY_HOME    0x105
+#define KEY_END     0x106
+#define KEY_PGUP    0x107
+#define KEY_PGDN    0x108
+#define KEY_INSERT  0x109
+#define KEY_DELETE  0x10a
+#define KEY_F(n)    (0x110 + (n))  /* F1 to F12 */
+
+/* Added to the code when Ctrl or Alt is held */
+#define KEY_CTRL    0x1000
+#define KEY_ALT     0x2000
+
+/* The code without the Ctrl and Alt flags */
+#define KEY_BASE(k) ((k) & 0xfff)
+
+extern int keymap_key(uint8_t, uint8_t);
+extern int keymap_select(const char *);
+
+#endif
@@ -5,6 +5,7 @@
  * Apurva Reddy (akr2177), Godwill Agbehonou (gea2118), Charles Chen (cc4919) 
  */
 #include "fbputchar.h"
+#include "render.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,18 +13,27 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include "usbkeyboard.h"
-#include <pthread.h>
+#include "keymap.h"
+#include "editor.h"
+#include "conn.h"
+#include "eventloop.h"
+#include "stats.h"
+#include "msglog.h"
+#include "search.h"
+#include "kbdrecord.h"
+#include <sys/signalfd.h>
+#include <time.h>
 
-/* Update SERVER_HOST to be the IP address of
- * the chat server you are connecting to
+/* The chat server, unless others are given on the command line or in
+ * CHATSERVER, as host[:port], separated by commas in CHATSERVER
  */
 /* arthur.cs.columbia.edu */
 #define SERVER_HOST "128.59.19.114"
 #define SERVER_PORT 42000
-#define COLS 64
-#define ROWS 24
+#define STATUS_SIZE 64 /* Longest connection status shown */
 
-#define BUFFER_SIZE 128
+#define OVERLAY_MS 1000 /* Time between updates of the latency overlay */
+#define CHATLOG_DIR "chatlog" /* Where messages are logged, unless CHATLOG says */
 
 /*
  * References:
@@ -34,30 +44,123 @@
  * 
  */
 
-int sockfd; /* Socket file descriptor */
+/*
+ * Rooms: one connection to a chat server each, reconnected as needed,
+ * all on the one event loop.  Each has a pane of the receive rows, and
+ * Tab picks the one the entry is sent to.  A room is numbered by where
+ * its server is in the list, in the log as on the screen.
+ */
+#define MAXROOMS FB_MAXPANES
+struct room {
+  const char *name;   /* host[:port], as given */
+  struct conn server;
+  int full;           /* Has its scrollback taken all it can from the log? */
+} rooms[MAXROOMS];
+int nrooms;
+int focus;            /* The room the entry goes to */
+
+int haskeyboard;      /* Is a keyboard attached (or being replayed)? */
+int watching;         /* Is usbkeyboard looking for one? */
+
+/* KBDRECORD saves the keyboard's reports, KBDREPLAY types them again */
+int recording;
+struct kbdreplay replay;
+int replaying;        /* Is the replay still typing? */
+int quitting;         /* Was ESC replayed before the replay finished? */
+
+/* The entry being typed, on the bottom two rows */
+struct editor entry;
+
+/* Frame pacing: at most one screen update every framems ms */
+int framems;
+int frametimer;
+int framepending = 0;
+struct timespec lastframe;
+
+/*
+ * Latencies: from a USB report arriving to the key being handled, to
+ * it showing on the screen, and (for Enter) to the message being
+ * written to the socket; and from reading a message to it showing.
+ * SIGUSR1 prints them, or writes them to STATSFILE if that is set, and
+ * F12 (or STATS_OVERLAY=1) shows the main ones on the separator line.
+ */
+struct stats_hist usbkey, keypixel, keysend, recvpixel;
+long long keyarrival;  /* When the report being handled arrived */
+const char *statsfile;
+int overlay, overlaytimer;
+
+/* Every message sent and received, unless CHATLOG is empty */
+struct msglog chatlog;
+int logging;
+int logdone;  /* Has the log been read back to the start? */
+
+/*
+ * Searching: Ctrl+F types the text to look for in the entry rows, and
+ * the focused room's pane shows the newest messages received in it
+ * that hold it.  Up and Down page through older and newer ones.
+ */
+struct editor query;
+int searching;
+int searchskip;          /* Newer matches than the ones shown */
+const char *searchtext;
+int searchlen;
+struct match {
+  const char *text;      /* In the log's mapped segments */
+  int len, at;
+} *matches;
+int nmatches, matchesseen, matchpage;
+struct stats_hist searchtime;
 
-struct libusb_device_handle *keyboard;
-uint8_t endpoint_address;
+/* Events waiting for the next frame to be on the screen */
+struct frame {
+  struct stats_marks keys, reads;
+};
+struct frame *frame;
 
-pthread_t network_thread;
-void *network_thread_f(void *);
-char bigMatrix[12][64];
-int topRow = 0;
-char buffer[1024];
 
-int main()
+void handle_key(int);
+void search_key(int);
+void find(void);
+void report_f(const struct usb_keyboard_packet *);
+void replay_done(struct kbdreplay *);
+void key_f(uint8_t, uint8_t, int);
+void show_message(const char *, int, const char *, int, void *);
+void status_f(struct conn *, void *);
+void plug_f(int);
+int send_f(const char *, int, void *);
+int room_state(struct room *, char *, int);
+void draw_status(void);
+void draw_title(int);
+void signal_f(int, uint32_t, void *);
+void frame_f(int, uint32_t, void *);
+void overlay_f(int, uint32_t, void *);
+void redraw(void);
+void print_stats(void);
+int older_f(int, int);
+void add_rooms(char *);
+
+int main(int argc, char *argv[])
 {
   //these initial variables ar eimportant
-  //we update err and col quite often, we use keystate 
-  //we use the struct packet
-  int err, col;
+  //we update err quite often
+  int err, scale, i, len, fast;
 
   struct sockaddr_in serv_addr;
-  struct usb_keyboard_packet packet;
-  int transferred;
-  char keystate[12];
+  sigset_t signals;
+  const char *layout, *font, *logdir, *record, *replayfile, *text;
+  char *hosts;
+
+  /* FBSURFACE=mem or file:... draws somewhere other than /dev/fb0, and
+     FBSCALE=1 fits more text on the screen, 3 or 4 less */
+  scale = getenv("FBSCALE") ? atoi(getenv("FBSCALE")) : FB_DEFAULTSCALE;
 
-  if ((err = fbopen()) != 0) {
+  /* FBFONT=/usr/share/consolefonts/... draws with a PSF2 font, which
+     shows whatever its Unicode table covers */
+  if ( (font = getenv("FBFONT")) != NULL && fbsetfont(font) != 0 ) {
+    fprintf(stderr, "Error: Could not load the font %s\n", font);
+    exit(1);
+  }
+  if ((err = fbopen_surface(getenv("FBSURFACE"), scale)) != 0) {
     fprintf(stderr, "Error: Could not open framebuffer: %d\n", err);
     exit(1);
   }
@@ -65,249 +168,700 @@ int main()
 	/* Clear the screen */
 	fbclear();
 
-	/* Draw horizontal line */
-	for (col = 0 ; col < COLS; col++) {
-		fbputchar('=', 21, col);
-	}
+  /* FBFPS=30 updates the screen less often, FBFPS=vsync once per
+     vertical blank */
+  framems = fbframems(getenv("FBFPS"));
 
-  /* Draw rows of asterisks across the top and bottom of the screen */
-//  for (col = 0 ; col < 64 ; col++) {
-//    fbputchar('*', 0, col);
-//    fbputchar('*', 23, col);
-//  }
-//
-//  fbputs("Hello CSEE 4840 World!", 4, 10);
-
-  /* Open the keyboard */
-  if ( (keyboard = openkeyboard(&endpoint_address)) == NULL ) {
-    fprintf(stderr, "Did not find a keyboard\n");
+  /* The rooms, each with a pane of the receive rows */
+  for (i = 1 ; i < argc ; i++)
+    add_rooms(argv[i]);
+  if (argc == 1 && (hosts = getenv("CHATSERVER")) != NULL &&
+      (hosts = strdup(hosts)) != NULL)
+    add_rooms(hosts);
+  if (nrooms == 0)
+    rooms[nrooms++].name = SERVER_HOST;
+  if (fbpanes(nrooms) < 0) {
+    fprintf(stderr, "Error: %d rooms do not fit on the screen\n", nrooms);
     exit(1);
   }
-    
-  /* Create a TCP communications socket */
-  if ( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
-    fprintf(stderr, "Error: Could not create socket\n");
+
+  /* Log messages to CHATLOG, or ./chatlog, and show the last screenful
+     of what is already there; older ones are read back when paging */
+  if ( (logdir = getenv("CHATLOG")) == NULL ) logdir = CHATLOG_DIR;
+  if (*logdir != '\0') {
+    if ( (err = msglog_open(&chatlog, logdir)) < 0 )
+      fprintf(stderr, "Could not open the message log %s (%d), not keeping one\n",
+	      logdir, err);
+    else {
+      logging = 1;
+      fbscrollback(older_f);
+      for (i = 0 ; i < nrooms ; i++)
+	older_f(i, fbpanerows(i));
+    }
+  }
+
+  /* From here on, only the render thread draws */
+  if (render_start() < 0) {
+    fprintf(stderr, "Error: Could not start the render thread\n");
     exit(1);
   }
 
-  /* Get the server address */
-  memset(&serv_addr, 0, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_port = htons(SERVER_PORT);
-  if ( inet_pton(AF_INET, SERVER_HOST, &serv_addr.sin_addr) <= 0) {
-    fprintf(stderr, "Error: Could not convert host IP \"%s\"\n", SERVER_HOST);
+  /* The entry is the bottom two rows, below the status line */
+  if (editor_init(&entry, fbrows() - 2, 2, fbcols()) < 0) {
+    fprintf(stderr, "Error: Could not create the entry editor\n");
     exit(1);
   }
 
-  /* Connect the socket to the server */
-  if ( connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-    fprintf(stderr, "Error: connect() failed.  Is the server running?\n");
+  /* The search text goes in the same rows, a page of matches above */
+  matchpage = fbrows() - 3;
+  if (editor_init(&query, fbrows() - 2, 2, fbcols()) < 0 ||
+      (matches = malloc(matchpage * sizeof(*matches))) == NULL) {
+    fprintf(stderr, "Error: Could not create the search editor\n");
     exit(1);
   }
+  search_init();
 
-  /* Start the network thread */
-  pthread_create(&network_thread, NULL, network_thread_f, NULL);
-
-  /* Look for and handle keypresses */
-  int cursor = 0;
-  char ascii = ' ';
-  char entry[2 * COLS + 1] = "";
-  char coveredChar = '\0';
-  for (;;) {
-	/* Highlight the cursor */
-	if (cursor > COLS && cursor < (2 * COLS)) {
-		/* Cursor is on the second line */
-		fbputchar('_', 23, cursor - COLS);
-	} else if (cursor >= 0 && cursor < COLS) {
-		/* Cursor is on the first line */
-		fbputchar('_', 22, cursor);
-	}
-	if(cursor < strlen(entry))
-		coveredChar = entry[cursor];
-    libusb_interrupt_transfer(keyboard, endpoint_address,
-			      (unsigned char *) &packet, sizeof(packet),
-			      &transferred, 0);
-	sleep(0.1);
-    if (transferred == sizeof(packet)) {
-      sprintf(keystate, "%02x %02x %02x", packet.modifiers, 
-	  	packet.keycode[0],packet.keycode[1]);
-
-      if (packet.keycode[0] == 0x29) { /* ESC pressed? */
-		break;
-      }
+  /* Everything below is driven by one event loop on this thread */
+  if (evloop_init() < 0) {
+    fprintf(stderr, "Error: Could not create the event loop\n");
+    exit(1);
+  }
 
-	  ascii = keyHandler(&packet);
-	  if(ascii == '\0')
-		continue;
+  /* Pick the keyboard layout, e.g. KEYMAP=dvorak */
+  if ( (layout = getenv("KEYMAP")) != NULL && keymap_select(layout) < 0 )
+    fprintf(stderr, "Unknown keyboard layout \"%s\", using us\n", layout);
 
-	  /* user clicks enter */
-	  if(ascii == '\n') {
-		int n;
-		cursor = 0;
-  		if ((n = send(sockfd, entry, strlen(entry), 0)) >= 0 ) {
-			printf("Sent %d bytes\n", n);
-		} else {
-			printf("Send failed");
-			break;
-		}
-		entry[0] = '\0';
-		fbclearrow(23);
-		fbclearrow(22);
-		continue;
-	  }
-	  
-	  if(ascii == 2) {
-		/* Cursor moves left */
-		if(cursor > 0 && cursor != strlen(entry)) {
-			if (cursor > COLS && cursor < (2 * COLS)) {
-				/* Cursor is on the second line */
-				fbputchar(coveredChar, 23, cursor - COLS);
-			} else if (cursor >= 0 && cursor < COLS) {
-				/* Cursor is on the first line */
-				fbputchar(coveredChar, 22, cursor);
-			}
-			cursor--;
-		} else if (cursor == strlen(entry)) {
-			if (cursor > COLS && cursor < (2 * COLS)) {
-				/* Cursor is on the second line */
-				fbputchar(' ', 23, cursor - COLS);
-			} else if (cursor >= 0 && cursor < COLS) {
-				/* Cursor is on the first line */
-				fbputchar(' ', 22, cursor);
-			}
-			cursor--;
-		}
-		continue;
-	  }
-
-	  if(ascii == 1) {
-		/* Cursor moves right */
-		if(cursor < strlen(entry)) {
-				if (cursor > COLS && cursor < (2 * COLS)) {
-					/* Cursor is on the second line */
-					fbputchar(coveredChar, 23, cursor - COLS);
-				} else if (cursor >= 0 && cursor < COLS) {
-					/* Cursor is on the first line */
-					fbputchar(coveredChar, 22, cursor);
-				}
-				cursor++;
-		}
-			continue;
-	  }
-
-		/* Backspce */
-	  if(ascii == '\b') {
-		/* Delete pressed */
-		if (cursor == strlen(entry)) {
-			/* End of the line */
-			entry[cursor - 1] = '\0';
-		} else if (cursor < strlen(entry) && cursor >= 0) {
-			/* Middle of line */
-			//entry[cursor] = ' ';
-			int length = strlen(entry);
-			for(int i = cursor; i < (strlen(entry)-1); i++){
-					entry[i] = entry[i+1];
-			}
-			entry[length-1] = '\0';
-			//entry[length] = '\0';
-			for(int col = 0; col < COLS; col++){
-					if(col < strlen(entry)){
-							fbputchar(entry[col],22, col);
-					}
-					else{
-							fbputchar(' ',22,col);
-					}
-					if(length-COLS-col > 0){
-							printf("%d\n", strlen(entry)-COLS-col);
-							fbputchar(entry[col+COLS],23,col);
-					}
-					else{
-							fbputchar(' ',23,col);
-					}
-			}
-		}
-		/* Adjust the display */
-	  	if (cursor > COLS && cursor < (2 * COLS)) {
-			/* Cursor is on the second line */
-			fbputchar(' ', 23, cursor - COLS);
-	  	} else if (cursor >= 0 && cursor < COLS) {
-			/* Cursor is on the first line */
-			fbputchar(' ', 22, cursor);
-		}
-		if (cursor > 0) {
-			cursor--;
-		}
-		continue;
-	  }
-		
-		/* Printable Character */
-	  printf("%c", ascii);
-	  if (cursor > COLS && cursor < (2 * COLS)) {
-		/* Cursor is on the second line */
-	  	fbputchar(ascii, 23, cursor - COLS);
-	  } else if (cursor >= 0 && cursor < COLS) {
-		/* Cursor is on the first line */
-	  	fbputchar(ascii, 22, cursor);
-	  }
-
-	  if (cursor == strlen(entry) && cursor < (2 * COLS)) {
-		/* Cursor is at the end and does not overflow buffer*/
-		entry[cursor] = ascii;
-		entry[cursor + 1] = '\0';
-		cursor++;
-	  } else if (cursor < strlen(entry) && cursor >= 0) {
-		/* Cursor is within the string */
-		int maxLength = strlen(entry);
-		for(int i = maxLength; i > cursor; i--){
-				entry[i] = entry[i-1]; 
-		}
-		entry[cursor] = ascii;
-		entry[maxLength+1] = '\0';
-		cursor++;
-
-		for(int col = 0; col < COLS; col++){
-				if(col < strlen(entry)){
-						fbputchar(entry[col],22, col);
-				}
-				else{
-						fbputchar(' ',22,col);
-				}
-				if(maxLength-COLS-col > 0){
-						printf("%d\n", strlen(entry)-COLS-col);
-						fbputchar(entry[col+COLS],23,col);
-				}
-				else{
-						fbputchar(' ',23,col);
-				}
-		}
-	  } else {
-		/* Cursor is at the end and may overflow buffer */
-		continue;
-	  }
+  stats_register(&usbkey, "usb-key");
+  stats_register(&keypixel, "key");
+  stats_register(&keysend, "send");
+  stats_register(&recvpixel, "recv");
+  stats_register(&searchtime, "search");
+  statsfile = getenv("STATSFILE");
+  if ( (frame = calloc(1, sizeof(*frame))) == NULL ||
+       (overlaytimer = evloop_timer(overlay_f, NULL)) < 0 ) {
+    fprintf(stderr, "Error: Could not set up the statistics\n");
+    exit(1);
+  }
+  if (getenv("STATS_OVERLAY") != NULL && atoi(getenv("STATS_OVERLAY"))) {
+    overlay = 1;
+    evloop_arm(overlaytimer, OVERLAY_MS, OVERLAY_MS);
+  }
+
+  /* KBDRECORD=file saves every report from the keyboard, with when it
+     came, and the entry left at the end */
+  if ( (record = getenv("KBDRECORD")) != NULL ) {
+    if (kbdrecord_open(record) < 0) {
+      fprintf(stderr, "Error: Could not write the recording %s\n", record);
+      exit(1);
+    }
+    recording = 1;
+  }
+
+  /* KBDREPLAY=file types what was recorded instead of reading the
+     keyboard, as fast as it was typed, or as fast as it can be handled
+     with KBDREPLAY=fast:file.  Otherwise look for a keyboard in the
+     background, and keep looking: until one is plugged in, messages
+     are still shown, so the client can be tried out against a local
+     server */
+  if ( (replayfile = getenv("KBDREPLAY")) != NULL ) {
+    if ( (fast = strncmp(replayfile, "fast:", 5) == 0) ) replayfile += 5;
+    if ( (err = kbdreplay_load(&replay, replayfile)) < 0 ) {
+      fprintf(stderr, "Error: Could not read the recording %s: %d\n",
+	      replayfile, err);
+      exit(1);
+    }
+    if ( keyboard_init(key_f) < 0 ||
+	 kbdreplay_start(&replay, fast, report_f, replay_done) < 0 ) {
+      fprintf(stderr, "Error: Could not replay the recording\n");
+      exit(1);
+    }
+    haskeyboard = 1;
+    replaying = 1;
+  } else if ( keyboard_init(key_f) < 0 ) {
+    fprintf(stderr, "Error: Could not create the key repeat timer\n");
+    exit(1);
+  } else if ( usbkeyboard_open(report_f, plug_f) < 0 )
+    fprintf(stderr, "Could not use USB, only showing messages\n");
+  else
+    watching = 1;
+
+
+  /* Paint the screen at most once per frame */
+  if ( (frametimer = evloop_timer(frame_f, NULL)) < 0 ) {
+    fprintf(stderr, "Error: Could not create the frame timer\n");
+    exit(1);
+  }
+
+  /* A write to a socket the server has closed should fail, not kill us */
+  signal(SIGPIPE, SIG_IGN);
 
-      printf("%s\n", keystate);
-      //fbputs(keystate, 6, 0);
+  /* Connect to every server, and again whenever a connection drops */
+  srand(time(NULL) ^ getpid());
+  for (i = 0 ; i < nrooms ; i++) {
+    if ( conn_resolve(&serv_addr, rooms[i].name, SERVER_PORT) < 0 ) {
+      fprintf(stderr, "Error: Could not find the server \"%s\"\n",
+	      rooms[i].name);
+      exit(1);
     }
+    if ( conn_init(&rooms[i].server, &serv_addr, show_message, status_f,
+		   &rooms[i]) < 0 ) {
+      fprintf(stderr, "Error: Could not create the reconnect timer\n");
+      exit(1);
+    }
+  }
+
+  /* Shut down cleanly on these instead of dying mid-frame */
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  sigaddset(&signals, SIGUSR1);
+  if ( evloop_signals(&signals, signal_f, NULL) < 0 ) {
+    fprintf(stderr, "Error: Could not watch for signals\n");
+    exit(1);
+  }
+
+  /* Look for and handle keypresses and messages until ESC */
+  editor_draw(&entry);
+  for (i = 0 ; i < nrooms ; i++)
+    draw_title(i);
+  redraw();
+  evloop_run();
+
+  if (watching) usbkeyboard_close();
+  if (recording) {
+    text = editor_text(&entry, &len);
+    kbdrecord_close(text, len);
+  }
+  for (i = 0 ; i < nrooms ; i++)
+    conn_close(&rooms[i].server);
+  render_stop();
+  if (logging) msglog_close(&chatlog);
+  if (statsfile != NULL) print_stats();
+
+  return 0;
+}
+
+/*
+ * Note when each report from the keyboard arrives
+ */
+void report_f(const struct usb_keyboard_packet *report)
+{
+  keyarrival = stats_now();
+  if (recording)
+	kbdrecord_report(report, keyarrival);
+  keyboard_report(report);
+}
+
+/*
+ * Say whether the replay left the entry as it was when the recording
+ * stopped, and quit if the recording did
+ */
+void replay_done(struct kbdreplay *p)
+{
+  const char *text;
+  int len, cursor = entry.gap;
+
+  text = editor_text(&entry, &len);
+  editor_move(&entry, cursor - entry.gap);
+  if (p->entry == NULL)
+	fprintf(stderr, "Replayed %u reports\n", p->count);
+  else
+	fprintf(stderr, "Replayed %u reports: the entry %s the recording\n",
+		p->count, len == p->entrylen && memcmp(text, p->entry, len) == 0 ?
+		"matches" : "differs from");
+  replaying = 0;
+  if (quitting)
+	evloop_stop();
+}
+
+/*
+ * Handle a key going down or repeating
+ */
+void key_f(uint8_t keycode, uint8_t modifiers, int state)
+{
+  int key;
+
+  if (state == KEY_RELEASED)
+	return;
+
+  /* A repeat comes from the timer, not a report */
+  if (state == KEY_REPEATED)
+	keyarrival = stats_now();
+
+  key = keymap_key(keycode, modifiers);
+  /* A replayed ESC quits once the rest of the replay is checked */
+  if (key == KEY_ESC && !searching) {
+	if (replaying)
+		quitting = 1;
+	else
+		evloop_stop();
+	return;
   }
+  if (key == KEY_NONE)
+	return;
+  stats_record(&usbkey, stats_now() - keyarrival, 1);
+
+  if (searching)
+	search_key(key);
+  else
+	handle_key(key);
+  editor_draw(searching ? &query : &entry);
+  stats_mark(&frame->keys, keyarrival);
+  redraw();
+}
+
+/*
+ * Edit the entry according to the key pressed
+ */
+void handle_key(int key)
+{
+  int was;
+
+  switch (key) {
+  /* Up and Down page through the messages received in the room */
+  case KEY_UP: render_scroll(focus, -1); break;
+  case KEY_DOWN: render_scroll(focus, 1); break;
+
+  /* Tab sends the entry to the next room instead */
+  case '\t':
+	if (nrooms == 1)
+		break;
+	was = focus;
+	focus = (focus + 1) % nrooms;
+	draw_title(was);
+	draw_title(focus);
+	draw_status();
+	break;
+
+  /* F12 shows or hides the latencies on the separator line */
+  case KEY_F(12):
+	overlay = !overlay;
+	evloop_arm(overlaytimer, overlay ? OVERLAY_MS : 0, OVERLAY_MS);
+	draw_status();
+	break;
 
-  /* Terminate the network thread */
-  pthread_cancel(network_thread);
+  /* Ctrl+F searches the log; the entry is kept until it is done */
+  case KEY_CTRL | 'f':
+	searching = 1;
+	searchskip = nmatches = 0;
+	matchpage = fbpanerows(focus);
+	editor_clear(&query);
+	editor_refresh(&query);
+	draw_status();
+	break;
 
-  /* Wait for the network thread to finish */
-  pthread_join(network_thread, NULL);
+  /* Enter sends the entry to the room */
+  default:
+	editor_enter(&entry, key, send_f, &rooms[focus]);
+	break;
+  }
+}
+
+/*
+ * Send the entry to a room and log it.  Returns 0, or -1 if its queue
+ * is full, to keep the entry and try again later.
+ */
+int send_f(const char *text, int len, void *arg)
+{
+  struct room *room = arg;
+  struct conn *server = &room->server;
 
+  if (conn_send(server, text, len) < 0)
+	return -1;
+  if (logging)
+	msglog_append(&chatlog, MSGLOG_SENT, room - rooms, text, len, NULL, 0);
+  if (conn_queued(server) == 0)
+	stats_record(&keysend, stats_now() - keyarrival, 1);
+  if (server->state != CONN_ONLINE) {
+	draw_title(room - rooms);
+	draw_status();
+  }
   return 0;
 }
 
-void *network_thread_f(void *ignored)
+/*
+ * Handle a key while searching: the results follow every change to the
+ * search text.  Enter or Esc goes back to the entry and the scrollback.
+ */
+void search_key(int key)
 {
-  char recvBuf[BUFFER_SIZE];
-  int n;
-  /* Receive data */
-  while ( (n = read(sockfd, &recvBuf, BUFFER_SIZE - 1)) > 0 ) {
-    recvBuf[n] = '\0';
-    printf("%s", recvBuf);
-	print_to_screen(recvBuf, &topRow, n);	
+  switch (key) {
+  case '\n':
+  case KEY_ESC:
+	searching = 0;
+	render_search(focus, NULL, 0);
+	editor_refresh(&entry);
+	draw_status();
+	break;
+
+  /* Older matches, if this page is full, and newer ones */
+  case KEY_UP:
+  case KEY_PGUP:
+  case KEY_CTRL | 'f':
+	if (nmatches == matchpage) {
+		searchskip += matchpage;
+		find();
+	}
+	break;
+  case KEY_DOWN:
+  case KEY_PGDN:
+	if (searchskip > 0) {
+		searchskip = searchskip > matchpage ? searchskip - matchpage : 0;
+		find();
+	}
+	break;
+
+  default:
+	if (editor_key(&query, key) == 1) {
+		searchskip = 0;
+		find();
+	}
+	break;
+  }
+}
+
+/* Keep each message holding the search text, after searchskip of them,
+   until there is a page of them */
+static int match_f(const struct msglog_entry *e, void *ignored)
+{
+  int at;
+
+  if (e->kind != MSGLOG_RECEIVED || e->room != focus ||
+      (at = search_find(e->text, e->len, searchtext, searchlen)) < 0)
+	return 0;
+  if (matchesseen++ < searchskip)
+	return 0;
+  matches[nmatches].text = e->text;
+  matches[nmatches].len = e->len;
+  matches[nmatches].at = at;
+  return ++nmatches == matchpage;
+}
+
+/*
+ * Look through the log, newest first, for a page of messages holding
+ * the search text and show them, oldest at the top.  Only the messages
+ * whose signatures have every trigram of the text are read.  Of a
+ * message too long to show whole, the part around the match is shown.
+ */
+void find(void)
+{
+  long long start = stats_now();
+  const char *text;
+  int cursor = query.gap, i, from, to;
+
+  searchtext = editor_text(&query, &searchlen);
+  nmatches = matchesseen = 0;
+  if (searchlen > 0 && logging)
+	msglog_scan(&chatlog, search_mask(searchtext, searchlen), match_f, NULL);
+
+  render_search(focus, searchtext, searchlen);
+  for (i = nmatches ; i-- > 0 ; ) {
+	text = matches[i].text;
+	from = 0;
+	to = matches[i].len;
+	if (to > RENDER_CHUNK) {
+		from = matches[i].at - (RENDER_CHUNK - searchlen) / 2;
+		if (from > matches[i].len - RENDER_CHUNK)
+			from = matches[i].len - RENDER_CHUNK;
+		if (from < 0)
+			from = 0;
+		to = from + RENDER_CHUNK;
+		/* Cut between characters */
+		while (from < matches[i].at && (text[from] & 0xc0) == 0x80)
+			from++;
+		while (to > matches[i].at + searchlen && to < matches[i].len &&
+		       (text[to] & 0xc0) == 0x80)
+			to--;
+	}
+	render_found(text + from, to - from);
+  }
+
+  /* editor_text() put the cursor at the end */
+  editor_move(&query, cursor - query.gap);
+  stats_record(&searchtime, stats_now() - start, 1);
+  draw_status();
+  redraw();
+}
+
+/*
+ * Echo a complete message from a room's server, add it to the room's
+ * pane and log it, straight out of the framer's buffer
+ */
+void show_message(const char *a, int alen, const char *b, int blen,
+		  void *arg)
+{
+  struct room *room = arg;
+  int i = room - rooms;
+
+  fwrite(a, 1, alen, stdout);
+  fwrite(b, 1, blen, stdout);
+  putchar('\n');
+  render_span(i, a, alen);
+  render_span(i, b, blen);
+  render_end(i);
+  stats_mark(&frame->reads, room->server.readat);
+  if (logging)
+	msglog_append(&chatlog, MSGLOG_RECEIVED, i, a, alen, b, blen);
+}
+
+/*
+ * Put at least lines more lines from the log in front of a room's
+ * scrollback, if there are that many messages received in it before
+ * this run.  Called by the render thread when paging back past the
+ * oldest line, and at startup to fill the screen.  The log is read
+ * back once for all the rooms, so the messages of the others passed
+ * on the way go in front of theirs.  Once a message does not fit, that
+ * scrollback is full for good, and anything older would leave a gap,
+ * so nothing more is put in it.
+ */
+int older_f(int pane, int lines)
+{
+  struct msglog_entry e;
+  int n, added = 0;
+
+  while (!logdone && !rooms[pane].full && added < lines) {
+	if (msglog_older(&chatlog, &e) < 0) {
+		logdone = 1;
+		break;
+	}
+	if (e.kind != MSGLOG_RECEIVED || e.room >= nrooms || rooms[e.room].full)
+		continue;
+	if ( (n = print_older(e.room, e.text, e.len)) < 0 )
+		rooms[e.room].full = 1;
+	else if (e.room == pane)
+		added += n;
+  }
+  return added;
+}
+
+/*
+ * Add a room for each server in the comma-separated list, which is
+ * kept.  Exits if there are too many.
+ */
+void add_rooms(char *list)
+{
+  char *name;
+
+  for (name = strtok(list, ",") ; name != NULL ; name = strtok(NULL, ",")) {
+	if (nrooms == MAXROOMS) {
+		fprintf(stderr, "Error: More than %d rooms\n", MAXROOMS);
+		exit(1);
+	}
+	rooms[nrooms++].name = name;
+  }
+}
+
+/*
+ * Describe the state of a room's connection in buf.  Returns its
+ * length, which may be more than fits.
+ */
+int room_state(struct room *room, char *buf, int size)
+{
+  struct conn *server = &room->server;
+  int n = 0;
+
+  switch (server->state) {
+  case CONN_ONLINE:
+	n = snprintf(buf, size, "online ");
+	break;
+  case CONN_CONNECTING:
+	n = snprintf(buf, size, "connecting ");
+	break;
+  case CONN_OFFLINE:
+	n = snprintf(buf, size, "offline, retrying in %.1fs ",
+		     server->retry / 1000.0);
+	break;
+  }
+  if (n < size && server->state != CONN_ONLINE &&
+      conn_queued(server) > 0)
+	n += snprintf(buf + n, size - n, "(%d queued) ",
+		      conn_queued(server));
+  return n;
+}
+
+/*
+ * Draw the line between the receive space and the entry, with the
+ * state of the connection on it
+ */
+void draw_status(void)
+{
+  char status[STATUS_SIZE], latency[STATUS_SIZE];
+  struct stats_hist *shown[] = { &keypixel, &recvpixel, &render_flushtime };
+  int col, n = 0, m = 0;
+
+  if (searching) {
+	if (searchlen == 0 || query.len == 0)
+		n = snprintf(status, sizeof(status), " search: type the text to find ");
+	else if (nmatches == 0)
+		n = snprintf(status, sizeof(status), " search: not found ");
+	else
+		n = snprintf(status, sizeof(status), " search: matches %d-%d ",
+			     searchskip + 1, searchskip + nmatches);
+  } else {
+	n = nrooms > 1 ?
+		snprintf(status, sizeof(status), " to %s: ", rooms[focus].name) :
+		snprintf(status, sizeof(status), " ");
+	if (n < (int) sizeof(status))
+		n += room_state(&rooms[focus], status + n, sizeof(status) - n);
+	if (!haskeyboard && n < (int) sizeof(status))
+		n += snprintf(status + n, sizeof(status) - n, "- no keyboard ");
+  }
+  if (n > (int) sizeof(status) - 1) n = sizeof(status) - 1;
+  if (n > fbcols() - 2) n = fbcols() - 2;
+
+  /* The latencies go at the right, if there is room */
+  if (overlay) {
+	m = stats_line(latency + 1, sizeof(latency) - 2, shown, 3);
+	if (m > (int) sizeof(latency) - 3 || n + m + 6 > fbcols())
+		m = 0;
+	else {
+		latency[0] = latency[m + 1] = ' ';
+		m += 2;
+	}
+  }
+
+  for (col = 0 ; col < fbcols() ; col++)
+	render_putchar(col >= 2 && col < n + 2 ? status[col - 2] :
+		       col >= fbcols() - 2 - m && col < fbcols() - 2 ?
+		       latency[col - (fbcols() - 2 - m)] : '=',
+		       fbrows() - 3, col);
+}
+
+/*
+ * Draw the title row of room i's pane, if it has one: its server and
+ * the state of the connection, on a line of '-', or '=' if the entry
+ * goes to it
+ */
+void draw_title(int i)
+{
+  char title[STATUS_SIZE];
+  int row = fbpanetitle(i), col, n;
+
+  if (row < 0)
+	return;
+  n = snprintf(title, sizeof(title), " %s: ", rooms[i].name);
+  if (n < (int) sizeof(title))
+	n += room_state(&rooms[i], title + n, sizeof(title) - n);
+  if (n > (int) sizeof(title) - 1) n = sizeof(title) - 1;
+  if (n > fbcols() - 2) n = fbcols() - 2;
+
+  for (col = 0 ; col < fbcols() ; col++)
+	render_putchar(col >= 2 && col < n + 2 ? title[col - 2] :
+		       i == focus ? '=' : '-', row, col);
+}
+
+/*
+ * A keyboard was plugged in, or went away: let go of any keys it was
+ * holding down, as a report so a recording has it too, and say whether
+ * there is one
+ */
+void plug_f(int attached)
+{
+  static const struct usb_keyboard_packet none;
+
+  if (!attached) report_f(&none);
+  haskeyboard = attached;
+  draw_status();
+  redraw();
+}
+
+void status_f(struct conn *c, void *arg)
+{
+  draw_title((struct room *) arg - rooms);
+  draw_status();
+  redraw();
+}
+
+void signal_f(int fd, uint32_t events, void *ignored)
+{
+  struct signalfd_siginfo info;
+
+  if (read(fd, &info, sizeof(info)) != sizeof(info))
+	return;
+  if (info.ssi_signo == SIGUSR1)
+	print_stats();
+  else
+	evloop_stop();
+}
+
+/*
+ * Write the latencies to STATSFILE, replacing what was there, or to
+ * stderr
+ */
+void print_stats(void)
+{
+  FILE *f;
+
+  if (statsfile == NULL) {
+	stats_print(stderr);
+	return;
+  }
+  if ( (f = fopen(statsfile, "w")) == NULL ) {
+	perror(statsfile);
+	return;
+  }
+  stats_print(f);
+  fclose(f);
+}
+
+void overlay_f(int fd, uint32_t events, void *ignored)
+{
+  draw_status();
+  redraw();
+}
+
+/* Called by the render thread once the frame is on the screen */
+static void pixel_f(void *arg)
+{
+  struct frame *done = arg;
+  long long now = stats_now();
+
+  stats_marks_record(&keypixel, &done->keys, now);
+  stats_marks_record(&recvpixel, &done->reads, now);
+  free(done);
+}
+
+static long ms_since(const struct timespec *then)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - then->tv_sec) * 1000 +
+    (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+/*
+ * Ask for the screen to be updated.  It happens straight away if the
+ * last update was at least a frame ago, otherwise when the frame timer
+ * goes off, so a burst of events costs one flush per frame.
+ */
+void redraw(void)
+{
+  long wait;
+
+  if (framepending) return;
+  wait = framems - ms_since(&lastframe);
+  if (wait <= 0) {
+	frame_f(frametimer, 0, NULL);
+	return;
+  }
+  framepending = 1;
+  evloop_arm(frametimer, wait, 0);
+}
+
+void frame_f(int fd, uint32_t events, void *ignored)
+{
+  struct frame *next;
+
+  framepending = 0;
+  clock_gettime(CLOCK_MONOTONIC, &lastframe);
+
+  /* Hand the events in this frame over, to be timed once it is shown */
+  if ((frame->keys.n > 0 || frame->reads.n > 0) &&
+      (next = calloc(1, sizeof(*next))) != NULL) {
+	render_call(pixel_f, frame);
+	frame = next;
   }
-  return NULL;
+  render_flush();
 }
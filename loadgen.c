@@ -0,0 +1,164 @@
+/*
+ * Load generator: simulated users flooding a chat server
+ *
+ * Usage: loadgen [-u users] [-r rate] [-s size] [-d seconds] [host[:port]]
+ *
+ * Connects users (default 8) to the server (default 127.0.0.1:42000)
+ * and, once all are on, sends rate messages a second (default 1000)
+ * between them, round robin, for the given number of seconds (default
+ * 5).  Each message is padded out to size bytes (default 64) and starts
+ *
+ *   user<n> <sequence> <CLOCK_MONOTONIC at sending, ns>
+ *
+ * so a client on the same machine can tell how long it took to show.
+ */
+#include "eventloop.h"
+#include "conn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define SERVER_PORT 42000
+#define TICK_MS 1        /* How often messages are sent */
+#define DRAIN_MS 500     /* Time left for the last messages to arrive */
+#define MAXSIZE 4096
+
+static struct conn *users;
+static int *up;            /* Is each user online? */
+static int nusers, online;
+static long rate, seconds;
+static int size = 64;
+
+static int ticker;
+static struct timespec start;
+static unsigned long sent, refused, received, seq;
+static int next;           /* User to send the next message */
+static int draining;
+
+static long long ns(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* Messages are counted and otherwise ignored */
+static void message_f(const char *a, int alen, const char *b, int blen,
+		      void *ignored)
+{
+  received++;
+}
+
+/* Start sending once every user is on */
+static void status_f(struct conn *c, void *arg)
+{
+  int *wasup = arg;
+
+  if (c->state == CONN_ONLINE && !*wasup) {
+    *wasup = 1;
+    if (++online == nusers && sent == 0 && !draining) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      evloop_arm(ticker, TICK_MS, TICK_MS);
+    }
+  } else if (c->state != CONN_ONLINE && *wasup) {
+    *wasup = 0;
+    online--;
+  }
+}
+
+/* Send however many messages are due by now */
+static void tick_f(int fd, uint32_t events, void *ignored)
+{
+  char text[MAXSIZE];
+  long long now = ns(), elapsed;
+  unsigned long due;
+  int n;
+
+  if (draining) {
+    evloop_stop();
+    return;
+  }
+  elapsed = now - (start.tv_sec * 1000000000LL + start.tv_nsec);
+  if (elapsed >= seconds * 1000000000LL) {
+    /* Stop sending and give the last messages time to arrive */
+    draining = 1;
+    evloop_arm(ticker, DRAIN_MS, 0);
+    return;
+  }
+
+  due = (unsigned long) (elapsed / 1e9 * rate);
+  while (sent + refused < due) {
+    n = snprintf(text, sizeof(text), "user%d %lu %lld ", next, seq++, now);
+    if (n < size) {
+      memset(text + n, 'x', size - n);
+      n = size;
+    }
+    if (conn_send(&users[next], text, n) < 0)
+      refused++;  /* Its queue is full: the server is not keeping up */
+    else
+      sent++;
+    next = (next + 1) % nusers;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct sockaddr_in addr;
+  double secs;
+  int opt, i;
+
+  nusers = 8;
+  rate = 1000;
+  seconds = 5;
+  while ( (opt = getopt(argc, argv, "u:r:s:d:")) != -1 )
+    switch (opt) {
+    case 'u': nusers = atoi(optarg); break;
+    case 'r': rate = atol(optarg); break;
+    case 's': size = atoi(optarg); break;
+    case 'd': seconds = atol(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-u users] [-r rate] [-s size] "
+	      "[-d seconds] [host[:port]]\n", argv[0]);
+      exit(1);
+    }
+  if (nusers < 1 || nusers > EVLOOP_MAXFD / 2 || rate < 1 || seconds < 1 ||
+      size < 1 || size > MAXSIZE) {
+    fprintf(stderr, "Error: Bad number of users, rate, size or time\n");
+    exit(1);
+  }
+  if ( conn_resolve(&addr, optind < argc ? argv[optind] : "127.0.0.1",
+		    SERVER_PORT) < 0 ) {
+    fprintf(stderr, "Error: Could not find \"%s\"\n", argv[optind]);
+    exit(1);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  srand(time(NULL) ^ getpid());
+  if ( evloop_init() < 0 || (ticker = evloop_timer(tick_f, NULL)) < 0 ) {
+    fprintf(stderr, "Error: Could not create the event loop\n");
+    exit(1);
+  }
+  users = calloc(nusers, sizeof(*users));
+  up = calloc(nusers, sizeof(*up));
+  if (users == NULL || up == NULL) {
+    fprintf(stderr, "Error: Could not allocate the users\n");
+    exit(1);
+  }
+  for (i = 0 ; i < nusers ; i++)
+    if ( conn_init(&users[i], &addr, message_f, status_f, &up[i]) < 0 ) {
+      fprintf(stderr, "Error: Could not create the reconnect timer\n");
+      exit(1);
+    }
+
+  evloop_run();
+
+  secs = seconds;
+  printf("loadgen: %d users sent %lu messages in %.0f s, %.0f/s; "
+	 "%lu not sent, queue full; %lu received\n", nusers, sent, secs,
+	 sent / secs, refused, received);
+  for (i = 0 ; i < nusers ; i++) conn_close(&users[i]);
+  return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * The message log: numbered, mapped segments appended to by a writer
+ * thread, read back newest first
+ */
+#include "msglog.h"
+#include "search.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Entries in one segment, at most: each takes at least its header */
+#define ENTRIES (MSGLOG_SEGMENT / sizeof(struct msglog_header))
+
+/* Entries start on 8-byte boundaries */
+#define ALIGN(n) (((n) + 7) & ~7)
+
+/*
+ * Map size bytes of the file dir/number.suffix, created and extended
+ * to that size if writable.  Returns NULL if it cannot be.
+ */
+static void *mapfile(const char *dir, unsigned number, const char *suffix,
+		     size_t size, int writable)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  void *p;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/%08u.%s", dir, number, suffix);
+  if ( (fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0 )
+    return NULL;
+  if (fstat(fd, &st) < 0 ||
+      ((size_t) st.st_size < size && (!writable || ftruncate(fd, size) < 0))) {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+	   MAP_SHARED, fd, 0);
+  close(fd);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+static void unmapsegment(struct msglog_segment *s)
+{
+  if (s->data != NULL) munmap(s->data, MSGLOG_SEGMENT);
+  if (s->ends != NULL) munmap((void *) s->ends, ENTRIES * sizeof(*s->ends));
+  if (s->sigs != NULL) munmap(s->sigs, ENTRIES * sizeof(*s->sigs));
+  s->data = NULL;
+  s->ends = NULL;
+  s->sigs = NULL;
+  s->count = 0;
+}
+
+/*
+ * Count the entries of a segment: the index is filled in order, so the
+ * first slot still 0 is found by bisection
+ */
+static void countentries(struct msglog_segment *s)
+{
+  unsigned lo = s->count, hi = ENTRIES, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (s->ends[mid] != 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  /* Anything past the end of the segment, or out of order, is damage */
+  while (lo > 0 && (s->ends[lo - 1] > MSGLOG_SEGMENT ||
+		    (lo > 1 && s->ends[lo - 1] <= s->ends[lo - 2])))
+    lo--;
+  s->count = lo;
+}
+
+/*
+ * Map segment number and count its entries.  The signatures are only
+ * a help: a segment without them is still read.  Returns 0, or -1 with
+ * nothing mapped.
+ */
+static int mapsegment(const char *dir, struct msglog_segment *s,
+		      unsigned number, int writable)
+{
+  s->number = number;
+  s->count = 0;
+  s->data = mapfile(dir, number, "log", MSGLOG_SEGMENT, writable);
+  s->ends = mapfile(dir, number, "idx", ENTRIES * sizeof(*s->ends), writable);
+  s->sigs = mapfile(dir, number, "sig", ENTRIES * sizeof(*s->sigs), writable);
+  if (s->data == NULL || s->ends == NULL || (writable && s->sigs == NULL)) {
+    unmapsegment(s);
+    return -1;
+  }
+  countentries(s);
+  return 0;
+}
+
+/* Where the entries of a segment end */
+static uint32_t segmentend(const struct msglog_segment *s)
+{
+  return s->count > 0 ? s->ends[s->count - 1] : 0;
+}
+
+/*
+ * Add one entry of size bytes to the segment being written, starting
+ * the next segment if it does not fit.  The text and the signature go
+ * in before the index, so an entry is never indexed before it is
+ * complete, and a scan on another thread never sees half of one.
+ */
+static int put(struct msglog *log, const char *entry, int size)
+{
+  struct msglog_segment *s = &log->out;
+  const struct msglog_header *h = (const struct msglog_header *) entry;
+  uint32_t end;
+
+  if (s->data != NULL &&
+      (segmentend(s) + size > MSGLOG_SEGMENT || s->count == ENTRIES)) {
+    unmapsegment(s);
+    if (mapsegment(log->dir, s, s->number + 1, 1) == 0)
+      atomic_store(&log->newest, s->number);
+  }
+  if (s->data == NULL) return -1;
+
+  end = segmentend(s);
+  memcpy(s->data + end, entry, size);
+  s->sigs[s->count] = search_signature((const char *) (h + 1), h->len);
+  atomic_store_explicit(&s->ends[s->count], end + size, memory_order_release);
+  s->count++;
+  return 0;
+}
+
+/*
+ * The writer thread: wait for a batch, swap it for the empty one so
+ * appending can go on, and copy the entries into the segments
+ */
+static void *writer_f(void *arg)
+{
+  struct msglog *log = arg;
+  const struct msglog_header *h;
+  const char *batch;
+  int len, off, size;
+  unsigned long lost = 0;
+  sigset_t all;
+
+  /* Signals are for the thread that watches for them */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  pthread_mutex_lock(&log->lock);
+  for (;;) {
+    while (log->batchlen == 0 && !log->stop)
+      pthread_cond_wait(&log->ready, &log->lock);
+    if (log->batchlen == 0) break;
+    log->dropped += lost;
+    lost = 0;
+
+    batch = log->batch[log->filling];
+    len = log->batchlen;
+    log->filling ^= 1;
+    log->batchlen = 0;
+    pthread_mutex_unlock(&log->lock);
+
+    for (off = 0 ; off < len ; off += size) {
+      h = (const struct msglog_header *) (batch + off);
+      size = ALIGN(sizeof(*h) + h->len);
+      if (put(log, batch + off, size) < 0) lost++;
+    }
+
+    pthread_mutex_lock(&log->lock);
+  }
+  log->dropped += lost;
+  pthread_mutex_unlock(&log->lock);
+  return NULL;
+}
+
+/*
+ * Open the log in dir, creating the directory if need be, and start
+ * the writer thread.  New entries go after the last one in the newest
+ * segment.  Returns 0 on success, or MSGLOG_DIR, MSGLOG_MAP or
+ * MSGLOG_NOMEM.
+ */
+int msglog_open(struct msglog *log, const char *dir)
+{
+  DIR *d;
+  struct dirent *e;
+  unsigned number, newest = 0;
+  int len;
+
+  memset(log, 0, sizeof(*log));
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) return MSGLOG_DIR;
+  if ( (d = opendir(dir)) == NULL ) return MSGLOG_DIR;
+  while ( (e = readdir(d)) != NULL ) {
+    len = 0;
+    if (sscanf(e->d_name, "%u.log%n", &number, &len) == 1 && len > 0 &&
+	e->d_name[len] == '\0' && number > newest)
+      newest = number;
+  }
+  closedir(d);
+
+  if ( (log->dir = strdup(dir)) == NULL ) return MSGLOG_NOMEM;
+  if (mapsegment(dir, &log->out, newest, 1) < 0 ||
+      mapsegment(dir, &log->back, newest, 0) < 0) {
+    msglog_close(log);
+    return MSGLOG_MAP;
+  }
+  log->back.count = log->out.count;
+  atomic_store(&log->newest, newest);
+
+  log->batch[0] = malloc(MSGLOG_BATCH);
+  log->batch[1] = malloc(MSGLOG_BATCH);
+  pthread_mutex_init(&log->lock, NULL);
+  pthread_cond_init(&log->ready, NULL);
+  if (log->batch[0] == NULL || log->batch[1] == NULL ||
+      pthread_create(&log->writer, NULL, writer_f, log) != 0) {
+    msglog_close(log);
+    return MSGLOG_NOMEM;
+  }
+  log->started = 1;
+  return 0;
+}
+
+/*
+ * Log a message of kind MSGLOG_RECEIVED or MSGLOG_SENT in a room,
+ * given as two spans like the framer's.  Only copies it into the batch
+ * the writer thread will take next; the batch has room for any message
+ * up to MSGLOG_LONGEST bytes.  Returns 0, or -1 if the batch is full
+ * and the message was dropped.
+ */
+int msglog_append(struct msglog *log, int kind, int room, const char *a,
+		  int alen, const char *b, int blen)
+{
+  struct msglog_header h;
+  struct timespec now;
+  int size = ALIGN(sizeof(h) + alen + blen);
+  char *p;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  h.time = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  h.len = alen + blen;
+  h.kind = kind;
+  h.room = room;
+
+  pthread_mutex_lock(&log->lock);
+  if (log->batchlen + size > MSGLOG_BATCH) {
+    log->dropped++;
+    pthread_mutex_unlock(&log->lock);
+    return -1;
+  }
+  p = log->batch[log->filling] + log->batchlen;
+  memcpy(p, &h, sizeof(h));
+  memcpy(p + sizeof(h), a, alen);
+  if (blen > 0) memcpy(p + sizeof(h) + alen, b, blen);
+  memset(p + sizeof(h) + h.len, 0, size - sizeof(h) - h.len);
+  if (log->batchlen == 0) pthread_cond_signal(&log->ready);
+  log->batchlen += size;
+  pthread_mutex_unlock(&log->lock);
+  return 0;
+}
+
+/*
+ * Read back the entry before the last one read, starting from the
+ * newest one logged before msglog_open(), going through the segments
+ * in turn.  Returns 0, or -1 once there are no more.
+ */
+int msglog_older(struct msglog *log, struct msglog_entry *e)
+{
+  struct msglog_segment *s = &log->back;
+  const struct msglog_header *h;
+  uint32_t start;
+
+  while (s->count == 0) {
+    if (s->data == NULL || s->number == 0) return -1;
+    start = s->number - 1;
+    unmapsegment(s);
+    if (mapsegment(log->dir, s, start, 0) < 0) return -1;
+  }
+
+  s->count--;
+  start = segmentend(s);
+  h = (const struct msglog_header *) (s->data + start);
+  if (s->ends[s->count] - start < sizeof(*h) ||
+      s->ends[s->count] - start - sizeof(*h) < h->len) {
+    unmapsegment(s);  /* Damaged: nothing before it can be trusted */
+    return -1;
+  }
+  e->time = h->time;
+  e->kind = h->kind;
+  e->room = h->room;
+  e->text = (const char *) (h + 1);
+  e->len = h->len;
+  return 0;
+}
+
+/*
+ * Call fn for every entry written so far whose signature has all the
+ * bits of mask, newest first, until fn returns nonzero.  Entries with
+ * no signature are all passed on.  Segments are mapped the first time
+ * they are scanned and stay mapped, so entries passed to fn stay valid
+ * until msglog_close().  Returns 1 if fn stopped the scan, 0 if every
+ * entry was looked at, or -1 if a segment could not be mapped.
+ */
+int msglog_scan(struct msglog *log, uint64_t mask, msglog_fn fn, void *arg)
+{
+  unsigned newest = atomic_load(&log->newest), n, i;
+  struct msglog_segment *s, *more;
+  const struct msglog_header *h;
+  struct msglog_entry e;
+  uint32_t start;
+
+  if (newest >= log->nscan) {
+    if ( (more = realloc(log->scan, (newest + 1) * sizeof(*more))) == NULL )
+      return -1;
+    memset(more + log->nscan, 0, (newest + 1 - log->nscan) * sizeof(*more));
+    log->scan = more;
+    log->nscan = newest + 1;
+  }
+
+  for (n = newest + 1 ; n-- > 0 ; ) {
+    s = &log->scan[n];
+    if (s->data == NULL && mapsegment(log->dir, s, n, 0) < 0) return -1;
+    countentries(s);  /* The writer may have added some */
+
+    for (i = s->count ; i-- > 0 ; ) {
+      if (s->sigs != NULL && (s->sigs[i] & SEARCH_SIGNED) &&
+	  (s->sigs[i] & mask) != mask)
+	continue;
+      start = i > 0 ? s->ends[i - 1] : 0;
+      h = (const struct msglog_header *) (s->data + start);
+      if (s->ends[i] - start < sizeof(*h) ||
+	  s->ends[i] - start - sizeof(*h) < h->len)
+	continue;  /* Damaged */
+      e.time = h->time;
+      e.kind = h->kind;
+      e.room = h->room;
+      e.text = (const char *) (h + 1);
+      e.len = h->len;
+      if (fn(&e, arg)) return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Write out whatever is waiting, stop the writer and unmap everything
+ */
+void msglog_close(struct msglog *log)
+{
+  if (log->started) {
+    pthread_mutex_lock(&log->lock);
+    log->stop = 1;
+    pthread_cond_signal(&log->ready);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->writer, NULL);
+    log->started = 0;
+  }
+  unmapsegment(&log->out);
+  unmapsegment(&log->back);
+  while (log->nscan > 0) unmapsegment(&log->scan[--log->nscan]);
+  free(log->scan);
+  log->scan = NULL;
+  free(log->batch[0]);
+  free(log->batch[1]);
+  free(log->dir);
+  log->batch[0] = log->batch[1] = NULL;
+  log->dir = NULL;
+}
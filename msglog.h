@@ -0,0 +1,97 @@
+#ifndef _MSGLOG_H
+#define _MSGLOG_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define MSGLOG_SEGMENT (4 << 20)  /* Bytes of entries in one segment */
+#define MSGLOG_LONGEST 65536      /* Longest text, as long as FRAMER_SIZE */
+#define MSGLOG_BATCH (4 * MSGLOG_LONGEST) /* Bytes of entries waiting */
+
+#define MSGLOG_RECEIVED 0
+#define MSGLOG_SENT 1
+
+#define MSGLOG_DIR -1     /* Couldn't create or read the directory */
+#define MSGLOG_MAP -2     /* Couldn't create or map a segment */
+#define MSGLOG_NOMEM -3   /* Couldn't allocate the batches or the thread */
+
+/*
+ * An append-only log of the messages sent and received, kept in a
+ * directory as numbered segments.  Segment N is three files: N.log
+ * holds the entries, each a struct msglog_header and its text padded
+ * to 8 bytes, N.idx where each entry ends, as a uint32_t, so the
+ * entries can be walked backwards without reading the ones before, and
+ * N.sig the trigram signature of each (see search.h), so a search can
+ * pass over most entries without reading them.  All are mapped; an
+ * index slot still 0 marks the end of the segment.
+ *
+ * msglog_append() only copies the entry into a batch in memory.  A
+ * writer thread takes whole batches and puts them in the segments, so
+ * the thread appending never waits for the disk; if the writer falls a
+ * whole batch behind, entries are dropped and counted.
+ *
+ * msglog_older() reads back what was logged before msglog_open(),
+ * newest first, one entry at a time.  msglog_scan() goes through
+ * everything written so far, newest first, alongside the writer: an
+ * entry is only indexed once its text and signature are in place.
+ *
+ * Every entry is tagged with the room, the connection it was sent to
+ * or received from, so one log serves any number of them.  Logs
+ * written before rooms were have every entry in room 0.
+ */
+struct msglog_header {
+  int64_t time;     /* CLOCK_REALTIME, ns */
+  uint32_t len;     /* Bytes of text */
+  uint16_t kind;    /* MSGLOG_RECEIVED or MSGLOG_SENT */
+  uint16_t room;    /* Which of the client's connections */
+};
+
+struct msglog_entry {
+  long long time;
+  int kind;
+  int room;
+  const char *text; /* Valid until the next msglog_older() */
+  int len;
+};
+
+/* Called by msglog_scan() for each entry; nonzero stops the scan */
+typedef int (*msglog_fn)(const struct msglog_entry *, void *);
+
+struct msglog_segment {
+  unsigned number;
+  char *data;               /* MSGLOG_SEGMENT bytes of entries, or NULL */
+  _Atomic uint32_t *ends;   /* Where each entry ends */
+  uint64_t *sigs;           /* The signature of each, or NULL */
+  unsigned count;           /* Entries */
+};
+
+struct msglog {
+  char *dir;
+
+  /* Filled by msglog_append(), emptied by the writer */
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  char *batch[2];
+  int filling;                  /* The batch being appended to */
+  int batchlen;
+  int stop;
+  unsigned long dropped;        /* Entries that did not fit */
+  pthread_t writer;
+  int started;                  /* Is the writer running? */
+
+  struct msglog_segment out;    /* Being appended to, by the writer */
+  atomic_uint newest;           /* out.number, for other threads */
+  struct msglog_segment back;   /* Being read back */
+  struct msglog_segment *scan;  /* Every segment, as msglog_scan() maps them */
+  unsigned nscan;
+};
+
+extern int msglog_open(struct msglog *, const char *);
+extern int msglog_append(struct msglog *, int, int, const char *, int,
+			 const char *, int);
+extern int msglog_older(struct msglog *, struct msglog_entry *);
+extern int msglog_scan(struct msglog *, uint64_t, msglog_fn, void *);
+extern void msglog_close(struct msglog *);
+
+#endif
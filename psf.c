@@ -0,0 +1,189 @@
+/*
+ * PC Screen Font (PSF2) loading
+ *
+ * The file is mapped rather than read, so glyphs are drawn straight
+ * from it.  Its Unicode table, if any, gives each glyph the codepoints
+ * it shows, in UTF-8, with 0xFE introducing combining sequences (which
+ * are skipped) and 0xFF ending the glyph's entry.  Without a table,
+ * glyph n shows codepoint n.
+ *
+ * References:
+ *
+ * https://www.win.tue.nl/~aeb/linux/kbd/font-formats-1.html
+ */
+#include "psf.h"
+#include "utf8.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PSF2_MAGIC 0x864ab572
+#define PSF2_HAS_UNICODE_TABLE 0x01
+#define PSF2_SEPARATOR 0xff
+#define PSF2_STARTSEQ 0xfe
+
+struct psf2_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t headersize;  /* Offset of the glyphs */
+  uint32_t flags;
+  uint32_t length;      /* Number of glyphs */
+  uint32_t charsize;    /* Bytes per glyph */
+  uint32_t height, width;
+};
+
+static void init(struct psf *f)
+{
+  memset(f->pages, 0, sizeof(f->pages));
+  f->map = NULL;
+  f->maplen = 0;
+}
+
+/* Record that codepoint cp is shown by glyph g.  The first glyph
+   found for a codepoint wins. */
+static int mapglyph(struct psf *f, uint32_t cp, int g)
+{
+  uint16_t **page;
+
+  if (cp >= 0x110000) return 0;
+  page = &f->pages[cp >> 8];
+  if (*page == NULL) {
+    if ( (*page = malloc(256 * sizeof(**page))) == NULL ) return -1;
+    memset(*page, 0xff, 256 * sizeof(**page)); /* PSF_NOGLYPH */
+  }
+  if ((*page)[cp & 0xff] == PSF_NOGLYPH) (*page)[cp & 0xff] = g;
+  return 0;
+}
+
+/* Index the Unicode table, which runs from p to end */
+static int unicodetable(struct psf *f, const unsigned char *p,
+			const unsigned char *end)
+{
+  struct utf8 u;
+  uint32_t cps[2];
+  unsigned long errors;
+  int g, n, i, skipping;
+
+  for (g = 0 ; g < f->nglyphs && p < end ; g++) {
+    utf8_init(&u);
+    skipping = 0;
+    for ( ; p < end && *p != PSF2_SEPARATOR ; p++) {
+      if (*p == PSF2_STARTSEQ) skipping = 1;
+      if (skipping) continue;
+      errors = u.errors;
+      n = utf8_decode(&u, (const char *) p, 1, cps);
+      if (u.errors != errors) continue; /* Malformed */
+      for (i = 0 ; i < n ; i++)
+	if (mapglyph(f, cps[i], g) < 0) return -1;
+    }
+    p++; /* The separator */
+  }
+  return 0;
+}
+
+/*
+ * Map the PSF2 font at path and index it.  Returns 0 on success or one
+ * of the PSF_... codes.
+ */
+int psf_open(struct psf *f, const char *path)
+{
+  struct psf2_header h;
+  struct stat st;
+  int fd, g;
+  const unsigned char *end;
+
+  init(f);
+  if ( (fd = open(path, O_RDONLY)) == -1 ) return PSF_OPEN;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return PSF_OPEN;
+  }
+  if (st.st_size < (off_t) sizeof(h)) {
+    close(fd);
+    return PSF_FORMAT;
+  }
+  f->maplen = st.st_size;
+  f->map = mmap(0, f->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (f->map == MAP_FAILED) {
+    f->map = NULL;
+    return PSF_OPEN;
+  }
+
+  memcpy(&h, f->map, sizeof(h));
+  if (h.magic != PSF2_MAGIC || h.width == 0 || h.height == 0 ||
+      h.charsize != (h.width + 7) / 8 * h.height || h.length == 0 ||
+      h.length > PSF_NOGLYPH ||
+      h.headersize + (uint64_t) h.length * h.charsize > f->maplen) {
+    psf_close(f);
+    return PSF_FORMAT;
+  }
+
+  f->width = h.width;
+  f->height = h.height;
+  f->rowbytes = (h.width + 7) / 8;
+  f->charsize = h.charsize;
+  f->nglyphs = h.length;
+  f->glyphs = (const unsigned char *) f->map + h.headersize;
+
+  if (h.flags & PSF2_HAS_UNICODE_TABLE) {
+    end = (const unsigned char *) f->map + f->maplen;
+    if (unicodetable(f, f->glyphs + f->nglyphs * f->charsize, end) < 0) {
+      psf_close(f);
+      return PSF_NOMEM;
+    }
+  } else
+    for (g = 0 ; g < f->nglyphs ; g++)
+      if (mapglyph(f, g, g) < 0) {
+	psf_close(f);
+	return PSF_NOMEM;
+      }
+  return 0;
+}
+
+/*
+ * Make a font of nglyphs width x height glyphs at glyphs, glyph n
+ * showing codepoint n.  Returns 0 or PSF_NOMEM.
+ */
+int psf_builtin(struct psf *f, const unsigned char *glyphs, int nglyphs,
+		int width, int height)
+{
+  int g;
+
+  init(f);
+  f->width = width;
+  f->height = height;
+  f->rowbytes = (width + 7) / 8;
+  f->charsize = f->rowbytes * height;
+  f->nglyphs = nglyphs;
+  f->glyphs = glyphs;
+  for (g = 0 ; g < nglyphs ; g++)
+    if (mapglyph(f, g, g) < 0) return PSF_NOMEM;
+  return 0;
+}
+
+/* The glyph for codepoint cp, or PSF_NOGLYPH */
+int psf_glyph(const struct psf *f, uint32_t cp)
+{
+  const uint16_t *page;
+
+  if (cp >= 0x110000 || (page = f->pages[cp >> 8]) == NULL)
+    return PSF_NOGLYPH;
+  return page[cp & 0xff];
+}
+
+void psf_close(struct psf *f)
+{
+  int i;
+
+  for (i = 0 ; i < PSF_PAGES ; i++) {
+    free(f->pages[i]);
+    f->pages[i] = NULL;
+  }
+  if (f->map != NULL) munmap(f->map, f->maplen);
+  f->map = NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef _PSF_H
+#define _PSF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PSF_NOGLYPH 0xffff          /* The font has nothing for this */
+#define PSF_PAGES (0x110000 >> 8)   /* Pages of 256 codepoints */
+
+#define PSF_OPEN -1     /* Couldn't open or map the file */
+#define PSF_FORMAT -2   /* Not a PSF2 font */
+#define PSF_NOMEM -3    /* Couldn't allocate the index */
+
+/*
+ * A bitmap font, and an index from Unicode codepoints to its glyphs in
+ * two levels: the top bits of a codepoint pick a page of 256 glyph
+ * numbers, the bottom 8 bits the entry.  Pages with nothing on them
+ * are NULL, so the index of a font covering a few scripts is small and
+ * a lookup is two loads.
+ */
+struct psf {
+  int width, height;            /* Pixels */
+  int rowbytes;                 /* Bytes in one row of a glyph */
+  int charsize;                 /* Bytes in one glyph */
+  int nglyphs;
+  const unsigned char *glyphs;  /* nglyphs glyphs, charsize bytes each */
+  uint16_t *pages[PSF_PAGES];
+  void *map;                    /* The file, if it was loaded from one */
+  size_t maplen;
+};
+
+extern int psf_open(struct psf *, const char *);
+extern int psf_builtin(struct psf *, const unsigned char *, int, int, int);
+extern int psf_glyph(const struct psf *, uint32_t);
+extern void psf_close(struct psf *);
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * The render thread
+ *
+ * Each producer thread has a single-producer, single-consumer ring of
+ * commands.  The producer writes a command past tail and then moves
+ * tail; the render thread reads from head up to tail and then moves
+ * head, so neither ever waits for the other.  When every ring is empty
+ * the render thread sleeps on an eventfd, which a producer writes only
+ * if it finds the render thread asleep.
+ *
+ * The render thread takes whatever is queued in all the rings as one
+ * batch, and flushes the framebuffer at most once per batch.  Commands
+ * are carried out in order; characters put only go into fbputchar's
+ * cell grid, so each cell is drawn once per flush however many times
+ * it was written, and not at all if it ends up as it was.
+ */
+#include "render.h"
+#include "fbputchar.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#define RENDER_PUT 0    /* Character c at row, col */
+#define RENDER_SPAN 1   /* n bytes received in pane row follow */
+#define RENDER_END 2    /* End of the message received in pane row */
+#define RENDER_SCROLL 3 /* Page pane row by n */
+#define RENDER_CLEAR 4
+#define RENDER_FLUSH 5
+#define RENDER_CALL 6   /* A struct rendercall follows */
+#define RENDER_SEARCH 7 /* Show results in pane row for the n bytes that follow */
+#define RENDER_FOUND 8  /* n bytes of a message found follow */
+
+/* Every command starts with one of these, followed by its text */
+struct rendercmd {
+  uint8_t op;
+  char c;
+  uint16_t row, col;
+  int16_t n;
+};
+
+struct rendercall {
+  render_fn fn;
+  void *arg;
+};
+
+/* Commands are padded so each header starts on an 8-byte boundary and
+   so never wraps around the end of a ring */
+#define CMDSIZE(len) (sizeof(struct rendercmd) + (((len) + 7) & ~7))
+
+struct renderq {
+  _Alignas(64) atomic_ulong head;  /* Next byte to read; render thread */
+  _Alignas(64) atomic_ulong tail;  /* Next byte to write; producer */
+  unsigned char buf[RENDER_RING];
+};
+
+static struct renderq queues[RENDER_PRODUCERS];
+static atomic_int nqueues;
+static __thread struct renderq *myqueue;
+
+static pthread_t renderer;
+static int wakefd = -1;
+static atomic_int sleeping;  /* Render thread waiting on wakefd? */
+static atomic_int stopping;
+
+/* Calls to make once the next flush is done */
+static struct rendercall calls[RENDER_CALLS];
+static int ncalls;
+
+struct stats_hist render_flushtime;
+
+static void wake(void)
+{
+  uint64_t one = 1;
+
+  if (atomic_load(&sleeping) && atomic_exchange(&sleeping, 0))
+    if (write(wakefd, &one, sizeof(one)) < 0)
+      perror("Could not wake the render thread");
+}
+
+/* The calling thread's ring, claimed the first time it draws */
+static struct renderq *queue(void)
+{
+  int i;
+
+  if (myqueue == NULL) {
+    if ( (i = atomic_fetch_add(&nqueues, 1)) >= RENDER_PRODUCERS ) {
+      fprintf(stderr, "Error: More than %d threads drawing\n",
+	      RENDER_PRODUCERS);
+      exit(1);
+    }
+    myqueue = &queues[i];
+  }
+  return myqueue;
+}
+
+/* Copy n bytes into the ring at position at, wrapping if need be */
+static void put(struct renderq *q, unsigned long at, const void *s, int n)
+{
+  unsigned long i = at % RENDER_RING;
+  int first = i + n <= RENDER_RING ? n : RENDER_RING - i;
+
+  memcpy(q->buf + i, s, first);
+  memcpy(q->buf, (const char *) s + first, n - first);
+}
+
+/* Copy n bytes out of the ring from position at */
+static void get(struct renderq *q, unsigned long at, void *s, int n)
+{
+  unsigned long i = at % RENDER_RING;
+  int first = i + n <= RENDER_RING ? n : RENDER_RING - i;
+
+  memcpy(s, q->buf + i, first);
+  memcpy((char *) s + first, q->buf, n - first);
+}
+
+/*
+ * Queue a command with len bytes of text.  Only if the render thread
+ * has fallen a whole ring behind does this wait, for it to catch up.
+ */
+static void push(int op, char c, int row, int col, int n,
+		 const char *text, int len)
+{
+  struct renderq *q = queue();
+  struct rendercmd cmd;
+  unsigned long tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  while (tail + CMDSIZE(len) - atomic_load_explicit(&q->head,
+		memory_order_acquire) > RENDER_RING) {
+    wake();
+    sched_yield();
+  }
+
+  cmd.op = op;
+  cmd.c = c;
+  cmd.row = row;
+  cmd.col = col;
+  cmd.n = n;
+  put(q, tail, &cmd, sizeof(cmd));
+  if (len > 0) put(q, tail + sizeof(cmd), text, len);
+  atomic_store(&q->tail, tail + CMDSIZE(len));
+  wake();
+}
+
+void render_putchar(char c, int row, int col)
+{
+  push(RENDER_PUT, c, row, col, 0, NULL, 0);
+}
+
+/* Add text to the message being received in a pane; see print_span() */
+void render_span(int pane, const char *s, int n)
+{
+  int len;
+
+  for ( ; n > 0 ; s += len, n -= len) {
+    len = n < RENDER_CHUNK ? n : RENDER_CHUNK;
+    push(RENDER_SPAN, 0, pane, 0, len, s, len);
+  }
+}
+
+/* Show search results; see print_search() and print_found() */
+void render_search(int pane, const char *s, int n)
+{
+  if (n > RENDER_CHUNK) n = RENDER_CHUNK;
+  push(RENDER_SEARCH, 0, pane, 0, n, s, n);
+}
+
+void render_found(const char *s, int n)
+{
+  if (n > RENDER_CHUNK) n = RENDER_CHUNK;
+  push(RENDER_FOUND, 0, 0, 0, n, s, n);
+}
+
+void render_end(int pane)
+{
+  push(RENDER_END, 0, pane, 0, 0, NULL, 0);
+}
+
+void render_scroll(int pane, int count)
+{
+  push(RENDER_SCROLL, 0, pane, 0, count, NULL, 0);
+}
+
+void render_clear(void)
+{
+  push(RENDER_CLEAR, 0, 0, 0, 0, NULL, 0);
+}
+
+void render_flush(void)
+{
+  push(RENDER_FLUSH, 0, 0, 0, 0, NULL, 0);
+}
+
+/*
+ * Have the render thread call fn(arg) once everything this thread has
+ * queued so far is on the screen, i.e. after the next flush.
+ */
+void render_call(render_fn fn, void *arg)
+{
+  struct rendercall call;
+
+  call.fn = fn;
+  call.arg = arg;
+  push(RENDER_CALL, 0, 0, 0, 0, (const char *) &call, sizeof(call));
+}
+
+/* Bytes following the command */
+static int textlen(const struct rendercmd *cmd)
+{
+  if (cmd->op == RENDER_SPAN || cmd->op == RENDER_SEARCH ||
+      cmd->op == RENDER_FOUND)
+    return cmd->n;
+  if (cmd->op == RENDER_CALL) return sizeof(struct rendercall);
+  return 0;
+}
+
+/* Flush, then make the calls that were waiting for it */
+static void flush(void)
+{
+  int i;
+  long long start = stats_now();
+
+  fbflush();
+  stats_record(&render_flushtime, stats_now() - start, 1);
+  for (i = 0 ; i < ncalls ; i++) calls[i].fn(calls[i].arg);
+  ncalls = 0;
+}
+
+/*
+ * Carry out everything queued in q.  Returns 1 if there was anything,
+ * and sets *flushing if it asked for a flush.
+ */
+static int drain(struct renderq *q, int *flushing)
+{
+  unsigned long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  unsigned long tail = atomic_load(&q->tail);
+  struct rendercmd cmd;
+  unsigned long at;
+  int first;
+  char text[RENDER_CHUNK];
+
+  if (head == tail) return 0;
+
+  for ( ; head != tail ; head += CMDSIZE(textlen(&cmd))) {
+    memcpy(&cmd, q->buf + head % RENDER_RING, sizeof(cmd));
+
+    if (cmd.op == RENDER_PUT) {
+      fbputchar(cmd.c, cmd.row, cmd.col);
+      continue;
+    }
+    if (cmd.op == RENDER_FLUSH) {
+      *flushing = 1;
+      continue;
+    }
+    if (cmd.op == RENDER_CALL) {
+      if (ncalls == RENDER_CALLS) flush();
+      get(q, head + sizeof(cmd), &calls[ncalls++], sizeof(*calls));
+      continue;
+    }
+
+    /* Received text and paging only draw when the batch is flushed,
+       after the cells */
+    switch (cmd.op) {
+    case RENDER_SPAN:
+      /* The text is passed straight from the ring, in up to two parts */
+      at = (head + sizeof(cmd)) % RENDER_RING;
+      first = at + cmd.n <= RENDER_RING ? cmd.n : RENDER_RING - at;
+      print_span(cmd.row, (const char *) q->buf + at, first);
+      if (first < cmd.n)
+	print_span(cmd.row, (const char *) q->buf, cmd.n - first);
+      break;
+    case RENDER_END:
+      print_end(cmd.row);
+      break;
+    case RENDER_SCROLL:
+      print_scroll(cmd.row, cmd.n);
+      break;
+    case RENDER_CLEAR:
+      fbclear();
+      break;
+    case RENDER_SEARCH:
+    case RENDER_FOUND:
+      get(q, head + sizeof(cmd), text, cmd.n);
+      if (cmd.op == RENDER_SEARCH) print_search(cmd.row, text, cmd.n);
+      else print_found(text, cmd.n);
+      break;
+    }
+  }
+
+  atomic_store_explicit(&q->head, head, memory_order_release);
+  return 1;
+}
+
+/* Is there anything in any ring? */
+static int pending(void)
+{
+  int i, n = atomic_load(&nqueues);
+
+  for (i = 0 ; i < n && i < RENDER_PRODUCERS ; i++)
+    if (atomic_load(&queues[i].head) != atomic_load(&queues[i].tail))
+      return 1;
+  return 0;
+}
+
+static void *render_f(void *ignored)
+{
+  int i, n, busy, flushing;
+  uint64_t count;
+
+  for (;;) {
+    busy = flushing = 0;
+    n = atomic_load(&nqueues);
+    for (i = 0 ; i < n && i < RENDER_PRODUCERS ; i++)
+      busy |= drain(&queues[i], &flushing);
+    if (flushing) flush();
+    if (busy) continue;
+
+    /* Sleep, unless something came in or a stop was asked for since the
+       rings were last looked at */
+    atomic_store(&sleeping, 1);
+    if (pending() || atomic_load(&stopping)) {
+      atomic_store(&sleeping, 0);
+      if (pending()) continue;
+      break;
+    }
+    if (read(wakefd, &count, sizeof(count)) < 0)
+      perror("Render thread could not wait");
+  }
+
+  flush();
+  return NULL;
+}
+
+/*
+ * Start the render thread.  fbopen() must be called first.  Returns 0,
+ * or -1 if the thread could not be started.
+ */
+int render_start(void)
+{
+  stats_register(&render_flushtime, "flush");
+  if ( (wakefd = eventfd(0, EFD_CLOEXEC)) < 0 )
+    return -1;
+  if (pthread_create(&renderer, NULL, render_f, NULL) != 0) {
+    close(wakefd);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Carry out everything already queued, flush, and stop the render
+ * thread.  fbputchar may be called directly again afterwards.
+ */
+void render_stop(void)
+{
+  uint64_t one = 1;
+
+  atomic_store(&stopping, 1);
+  if (atomic_exchange(&sleeping, 0))
+    if (write(wakefd, &one, sizeof(one)) < 0)
+      perror("Could not wake the render thread");
+  pthread_join(renderer, NULL);
+  close(wakefd);
+}
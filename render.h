@@ -0,0 +1,36 @@
+#ifndef _RENDER_H
+#define _RENDER_H
+
+#include "stats.h"
+
+#define RENDER_RING 65536     /* Bytes of commands queued per producer */
+#define RENDER_PRODUCERS 8    /* Threads that may draw */
+#define RENDER_CHUNK 1024     /* Longest span of text in one command */
+#define RENDER_CALLS 64       /* render_call()s waiting for a flush */
+
+/* Called on the render thread; see render_call() */
+typedef void (*render_fn)(void *);
+
+/*
+ * Drawing from any thread.  Each call queues a command for the render
+ * thread, which is the only one to touch fbputchar once render_start()
+ * has been called.  Every thread that draws gets its own ring, so
+ * queueing takes no lock and never waits for pixels to be pushed; the
+ * commands from one thread are carried out in the order they were
+ * queued.
+ */
+extern struct stats_hist render_flushtime;  /* How long each flush took */
+
+extern int render_start(void);
+extern void render_stop(void);
+extern void render_putchar(char, int, int);
+extern void render_span(int, const char *, int);
+extern void render_end(int);
+extern void render_scroll(int, int);
+extern void render_clear(void);
+extern void render_flush(void);
+extern void render_call(render_fn, void *);
+extern void render_search(int, const char *, int);
+extern void render_found(const char *, int);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Substring search and trigram signatures
+ *
+ * The SSE2 and AVX2 kernels compare the first and the last byte of the
+ * needle with 16 or 32 positions of the haystack at once, and only
+ * where both match compare the bytes in between, so most of the
+ * haystack is passed over a vector at a time whatever the needle.
+ * Like the pixel kernels, they are compiled with target attributes and
+ * picked at run time.
+ */
+#include "search.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+/* Bit 1 to 63 for the trigram starting at s */
+#define TRIGRAM_BIT(s) \
+  ((uint64_t) 2 << ((((unsigned char) (s)[0] | (unsigned char) (s)[1] << 8 | \
+		      (unsigned) (unsigned char) (s)[2] << 16) * 0x9e3779b1u >> 16) % 63))
+
+static int find_scalar(const char *hay, int n, const char *needle, int m)
+{
+  const char *p = hay, *end = hay + n - m;
+
+  if (m == 0) return 0;
+  for ( ; p <= end ; p++) {
+    if ( (p = memchr(p, needle[0], end - p + 1)) == NULL ) return -1;
+    if (memcmp(p + 1, needle + 1, m - 1) == 0) return p - hay;
+  }
+  return -1;
+}
+
+#ifdef SEARCH_X86
+
+__attribute__((target("sse2")))
+static int find_sse2(const char *hay, int n, const char *needle, int m)
+{
+  __m128i first, last, a, b;
+  unsigned mask;
+  int i, bit;
+
+  if (m < 2) return find_scalar(hay, n, needle, m);
+  first = _mm_set1_epi8(needle[0]);
+  last = _mm_set1_epi8(needle[m - 1]);
+  for (i = 0 ; i + m - 1 + 16 <= n ; i += 16) {
+    a = _mm_loadu_si128((const __m128i *) (hay + i));
+    b = _mm_loadu_si128((const __m128i *) (hay + i + m - 1));
+    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+					   _mm_cmpeq_epi8(b, last)));
+    for ( ; mask ; mask &= mask - 1) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return i + bit;
+    }
+  }
+  if ( (bit = find_scalar(hay + i, n - i, needle, m)) < 0 ) return -1;
+  return i + bit;
+}
+
+__attribute__((target("avx2")))
+static int find_avx2(const char *hay, int n, const char *needle, int m)
+{
+  __m256i first, last, a, b;
+  unsigned mask;
+  int i, bit;
+
+  if (m < 2) return find_scalar(hay, n, needle, m);
+  first = _mm256_set1_epi8(needle[0]);
+  last = _mm256_set1_epi8(needle[m - 1]);
+  for (i = 0 ; i + m - 1 + 32 <= n ; i += 32) {
+    a = _mm256_loadu_si256((const __m256i *) (hay + i));
+    b = _mm256_loadu_si256((const __m256i *) (hay + i + m - 1));
+    mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+						 _mm256_cmpeq_epi8(b, last)));
+    for ( ; mask ; mask &= mask - 1) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return i + bit;
+    }
+  }
+  if ( (bit = find_sse2(hay + i, n - i, needle, m)) < 0 ) return -1;
+  return i + bit;
+}
+
+#endif
+
+search_find_fn search_find = find_scalar;
+const char *search_name = "scalar";
+
+/* Select a kernel by name: "scalar", "sse2" or "avx2".  Returns -1 if
+   the CPU cannot run it. */
+int search_select(const char *name)
+{
+  if (strcmp(name, "scalar") == 0)
+    search_find = find_scalar;
+#ifdef SEARCH_X86
+  else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    search_find = find_sse2;
+  else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    search_find = find_avx2;
+#endif
+  else
+    return -1;
+  search_name = name;
+  return 0;
+}
+
+/* Pick the best kernel this CPU can run */
+void search_init(void)
+{
+#ifdef SEARCH_X86
+  __builtin_cpu_init();
+  if (search_select("avx2") == 0 || search_select("sse2") == 0)
+    return;
+#endif
+  search_select("scalar");
+}
+
+/* The bits of every trigram in the n bytes at s */
+uint64_t search_mask(const char *s, int n)
+{
+  uint64_t mask = 0;
+  int i;
+
+  for (i = 0 ; i + 3 <= n ; i++)
+    mask |= TRIGRAM_BIT(s + i);
+  return mask;
+}
+
+/* The signature of a message of n bytes */
+uint64_t search_signature(const char *s, int n)
+{
+  return search_mask(s, n) | SEARCH_SIGNED;
+}
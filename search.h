@@ -0,0 +1,30 @@
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include <stdint.h>
+
+/*
+ * Finding text in messages.
+ *
+ * search_find(hay, n, needle, m) returns where needle first occurs in
+ * hay, or -1.  The kernel is picked by search_init() for this CPU.
+ *
+ * Each message also has a signature: one bit for each of its trigrams,
+ * hashed to 63 bits, and bit 0 set to say the signature is there.  A
+ * message can only contain the text if its signature has every bit of
+ * the text's search_mask(), so most messages are ruled out without
+ * reading them.  Text shorter than a trigram has an empty mask.
+ */
+#define SEARCH_SIGNED 1   /* Bit 0: the signature was computed */
+
+typedef int (*search_find_fn)(const char *, int, const char *, int);
+
+extern search_find_fn search_find;
+extern const char *search_name;
+
+extern void search_init(void);
+extern int search_select(const char *);
+extern uint64_t search_signature(const char *, int);
+extern uint64_t search_mask(const char *, int);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Search benchmark: a log of made-up messages, searched the way the
+ * client does on each key typed
+ *
+ * Usage: searchbench [-n messages] [dir]
+ *
+ * Fills a message log in dir (a new directory under /tmp by default)
+ * with messages of random words, then times finding the newest page
+ * of matches and counting every match, with each substring kernel,
+ * with and without the trigram signatures.  A search has to take less
+ * than a frame to keep up with typing.
+ */
+#include "msglog.h"
+#include "search.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define PAGE 40      /* Matches on one page */
+#define RUNS 5       /* Times each search is made */
+
+static const char *words[] = {
+  "the", "lab", "is", "due", "on", "friday", "who", "has", "a", "working",
+  "keyboard", "driver", "my", "framebuffer", "shows", "garbage", "try",
+  "rebooting", "board", "again", "did", "you", "flash", "image", "socket",
+  "server", "down", "again?", "anyone", "at", "office", "hours", "today",
+  "compiled", "fine", "but", "usb", "hangs", "after", "second", "key",
+};
+
+/* Found in one message in a few hundred, not at all, and everywhere */
+static const char *queries[] = { "usb hangs", "zebra crossing", "the", "ke" };
+
+static const char *text;
+static int len, count, page;
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int match_f(const struct msglog_entry *e, void *ignored)
+{
+  if (search_find(e->text, e->len, text, len) < 0) return 0;
+  return ++count == page;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *kernels[] = { "scalar", "sse2", "avx2" };
+  char dir[] = "/tmp/searchbench.XXXXXX", message[256];
+  const char *path = dir;
+  struct msglog log;
+  long messages = 300000, i;
+  unsigned k, q, p;
+  int n, w, run, err;
+  uint64_t mask;
+  double start, secs;
+
+  while ( (n = getopt(argc, argv, "n:")) != -1 )
+    switch (n) {
+    case 'n': messages = atol(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-n messages] [dir]\n", argv[0]);
+      exit(1);
+    }
+  if (optind < argc) path = argv[optind];
+  else if (mkdtemp(dir) == NULL) {
+    perror(dir);
+    exit(1);
+  }
+
+  if ( (err = msglog_open(&log, path)) < 0 ) {
+    fprintf(stderr, "Error: Could not open the log in %s: %d\n", path, err);
+    exit(1);
+  }
+  srand(1);
+  for (i = 0 ; i < messages ; i++) {
+    n = snprintf(message, sizeof(message), "user%d", rand() % 16);
+    for (w = 0 ; w < 4 + rand() % 12 ; w++)
+      n += snprintf(message + n, sizeof(message) - n, " %s",
+		    words[rand() % (sizeof(words) / sizeof(words[0]))]);
+    while (msglog_append(&log, MSGLOG_RECEIVED, 0, message, n, NULL, 0) < 0)
+      usleep(1000); /* Let the writer catch up */
+  }
+  msglog_close(&log);
+  msglog_open(&log, path);
+  printf("%ld messages in %s\n", messages, path);
+
+  search_init();
+  for (k = 0 ; k < sizeof(kernels) / sizeof(kernels[0]) ; k++) {
+    if (search_select(kernels[k]) < 0) continue;
+    for (q = 0 ; q < sizeof(queries) / sizeof(queries[0]) ; q++)
+      for (p = 0 ; p < 2 ; p++) {
+	text = queries[q];
+	len = strlen(text);
+	page = p == 0 ? PAGE : -1;
+	for (mask = search_mask(text, len) ; ; mask = 0) {
+	  start = now();
+	  for (run = 0 ; run < RUNS ; run++) {
+	    count = 0;
+	    msglog_scan(&log, mask, match_f, NULL);
+	  }
+	  secs = (now() - start) / RUNS;
+	  printf("%-6s %-16s %-5s %8d found %8.2f ms%s\n", kernels[k], text,
+		 p == 0 ? "page" : "all", count, secs * 1e3,
+		 mask ? "" : " without signatures");
+	  if (mask == 0) break;
+	}
+      }
+  }
+
+  msglog_close(&log);
+  return 0;
+}
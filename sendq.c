@@ -0,0 +1,87 @@
+/*
+ * The outbound message queue
+ */
+#include "sendq.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+void sendq_init(struct sendq *q)
+{
+  q->head = q->tail = q->start = 0;
+  q->msghead = q->msgtail = 0;
+}
+
+/* Copy n bytes into the ring at tail, wrapping if need be */
+static void put(struct sendq *q, const char *s, int n)
+{
+  unsigned long at = q->tail % SENDQ_SIZE;
+  int first = at + n <= SENDQ_SIZE ? n : SENDQ_SIZE - at;
+
+  memcpy(q->buf + at, s, first);
+  memcpy(q->buf, s + first, n - first);
+  q->tail += n;
+}
+
+/*
+ * Queue a message of n bytes.  Returns 0 on success or -1 if there is
+ * no room for it, in which case nothing is queued.  The room is counted
+ * from the start of the oldest unsent message, not from what has been
+ * written, as a partly written message may have to be sent again whole
+ * (see sendq_rewind()).
+ */
+int sendq_push(struct sendq *q, const char *s, int n)
+{
+  if (q->msgtail - q->msghead == SENDQ_MSGS ||
+      q->tail - q->start + n + 1 > SENDQ_SIZE)
+    return -1;
+
+  put(q, s, n);
+  put(q, "\n", 1);
+  q->ends[q->msgtail++ % SENDQ_MSGS] = q->tail;
+  return 0;
+}
+
+/*
+ * Write as much of the queue to fd as it will take without blocking.
+ * Returns 0 once everything is sent, 1 if some is left waiting for fd
+ * to become writable, or -1 with errno set if the write failed.
+ */
+int sendq_flush(struct sendq *q, int fd)
+{
+  struct iovec iov[2];
+  unsigned long at, n;
+  ssize_t sent;
+  int niov;
+
+  while (q->head < q->tail) {
+    at = q->head % SENDQ_SIZE;
+    n = q->tail - q->head;
+    iov[0].iov_base = q->buf + at;
+    iov[0].iov_len = at + n <= SENDQ_SIZE ? n : SENDQ_SIZE - at;
+    iov[1].iov_base = q->buf;
+    iov[1].iov_len = n - iov[0].iov_len;
+    niov = iov[1].iov_len > 0 ? 2 : 1;
+
+    if ( (sent = writev(fd, iov, niov)) < 0 ) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+      return -1;
+    }
+    q->head += sent;
+    while (q->msghead != q->msgtail &&
+	   q->ends[q->msghead % SENDQ_MSGS] <= q->head)
+      q->start = q->ends[q->msghead++ % SENDQ_MSGS];
+  }
+  return 0;
+}
+
+/*
+ * Go back to the start of a message that was only partly written, so
+ * that it is sent whole over a new connection
+ */
+void sendq_rewind(struct sendq *q)
+{
+  q->head = q->start;
+}
@@ -0,0 +1,26 @@
+#ifndef _SENDQ_H
+#define _SENDQ_H
+
+#define SENDQ_SIZE 16384  /* Bytes of messages waiting to be sent */
+#define SENDQ_MSGS 64     /* Messages waiting to be sent */
+
+/*
+ * Outgoing messages, each followed by a newline, in a ring buffer.
+ * Everything queued is written with one writev() of at most two spans,
+ * picking up after however much the last write took.
+ */
+struct sendq {
+  unsigned long head;             /* Bytes sent */
+  unsigned long tail;             /* Bytes queued */
+  unsigned long ends[SENDQ_MSGS]; /* Where each queued message ends */
+  unsigned long start;            /* Where the oldest unsent message starts */
+  unsigned msghead, msgtail;      /* Messages sent, messages queued */
+  char buf[SENDQ_SIZE];
+};
+
+extern void sendq_init(struct sendq *);
+extern int sendq_push(struct sendq *, const char *, int);
+extern int sendq_flush(struct sendq *, int);
+extern void sendq_rewind(struct sendq *);
+
+#endif
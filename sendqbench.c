@@ -0,0 +1,154 @@
+/*
+ * Send queue benchmark: messages queued and written to a pipe, and a
+ * message cut off by a dropped connection sent again whole
+ *
+ * Usage: sendqbench [-n messages]
+ *
+ * Times queueing messages of a few sizes and writing them out with
+ * sendq_flush(), as the client does when the server keeps up.  Then
+ * checks the case a dropped connection leaves: a long message only
+ * partly written, more queued while offline until the queue is full,
+ * and everything written again after sendq_rewind().  What comes out
+ * must be the first message whole and the others after it, byte for
+ * byte.  Exits 1 if it is not.
+ */
+#define _GNU_SOURCE  /* F_SETPIPE_SZ */
+#include "sendq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#define CUTOFF 4096    /* Bytes the pipe takes before the "drop" */
+#define FIRST 10000    /* The message cut off */
+#define LATER 1000     /* The messages queued while offline */
+
+static struct sendq q;
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* A non-blocking pipe holding at most size bytes */
+static int openpipe(int fds[2], int size)
+{
+  if (pipe(fds) < 0) return -1;
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  return fcntl(fds[1], F_SETPIPE_SZ, size) < size ? -1 : 0;
+}
+
+/* Read whatever is in the pipe into buf, up to size bytes */
+static int drain(int fd, char *buf, int size)
+{
+  int n = 0, r;
+
+  while (n < size && (r = read(fd, buf + n, size - n)) > 0)
+    n += r;
+  return n;
+}
+
+/*
+ * Cut a message off after CUTOFF bytes, queue more until there is no
+ * room, rewind and write again.  Returns 1 if what was written the
+ * second time is exactly what was queued.
+ */
+static int rewound(void)
+{
+  static char first[FIRST], later[LATER], want[2 * SENDQ_SIZE];
+  static char got[2 * SENDQ_SIZE];
+  int cut[2], out[2], len, wantlen, queued = 0, same;
+
+  if (openpipe(cut, CUTOFF) < 0 || openpipe(out, 1 << 20) < 0) {
+    fprintf(stderr, "Error: Could not make the pipes\n");
+    exit(1);
+  }
+  memset(first, 'A', sizeof(first));
+  memset(later, 'B', sizeof(later));
+
+  sendq_init(&q);
+  sendq_push(&q, first, sizeof(first));
+  if (sendq_flush(&q, cut[1]) != 1 || q.head != CUTOFF) {
+    fprintf(stderr, "Error: The pipe took %lu bytes, not %d\n",
+	    q.head, CUTOFF);
+    exit(1);
+  }
+
+  /* The connection dropped; messages typed meanwhile are queued */
+  while (sendq_push(&q, later, sizeof(later)) == 0)
+    queued++;
+
+  /* Back online */
+  sendq_rewind(&q);
+  sendq_flush(&q, out[1]);
+  len = drain(out[0], got, sizeof(got));
+
+  memcpy(want, first, sizeof(first));
+  want[sizeof(first)] = '\n';
+  for (wantlen = sizeof(first) + 1 ; queued-- > 0 ; wantlen += LATER + 1) {
+    memcpy(want + wantlen, later, LATER);
+    want[wantlen + LATER] = '\n';
+  }
+  same = len == wantlen && memcmp(got, want, len) == 0;
+  printf("sendqbench: %d bytes cut off at %d, %d bytes sent again, %s\n",
+	 FIRST, CUTOFF, len, same ? "whole" : "CORRUPTED");
+
+  close(cut[0]);
+  close(cut[1]);
+  close(out[0]);
+  close(out[1]);
+  return same;
+}
+
+int main(int argc, char *argv[])
+{
+  static const int sizes[] = { 16, 64, 512 };
+  static char message[512], buf[SENDQ_SIZE];
+  long messages = 2000000, i;
+  int fds[2], opt;
+  unsigned s;
+  double start, secs;
+
+  while ( (opt = getopt(argc, argv, "n:")) != -1 )
+    switch (opt) {
+    case 'n': messages = atol(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-n messages]\n", argv[0]);
+      exit(1);
+    }
+
+  if (openpipe(fds, 1 << 20) < 0) {
+    fprintf(stderr, "Error: Could not make the pipe\n");
+    exit(1);
+  }
+  memset(message, 'x', sizeof(message));
+
+  /* Queue until full, write it all out, and read it back */
+  for (s = 0 ; s < sizeof(sizes) / sizeof(sizes[0]) ; s++) {
+    sendq_init(&q);
+    start = now();
+    for (i = 0 ; i < messages ; ) {
+      while (i < messages && sendq_push(&q, message, sizes[s]) == 0)
+	i++;
+      if (sendq_flush(&q, fds[1]) < 0) {
+	perror("sendqbench");
+	exit(1);
+      }
+      while (drain(fds[0], buf, sizeof(buf)) > 0)
+	;
+    }
+    secs = now() - start;
+    printf("sendq %4d bytes %12.0f messages/s %8.1f MB/s\n", sizes[s],
+	   messages / secs, messages * (sizes[s] + 1) / secs / 1e6);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  return rewound() ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/*
+ * Latency histograms
+ *
+ * References:
+ *
+ * http://hdrhistogram.org/
+ */
+#include "stats.h"
+
+#include <time.h>
+
+static struct stats_hist *hists[STATS_MAX];
+static atomic_int nhists;
+
+/* CLOCK_MONOTONIC, ns */
+long long stats_now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/*
+ * Empty h, name it, and have stats_print() show it.  Histograms that do
+ * not fit are still recorded, just not printed.
+ */
+void stats_register(struct stats_hist *h, const char *name)
+{
+  int i;
+
+  h->name = name;
+  atomic_init(&h->count, 0);
+  atomic_init(&h->max, 0);
+  for (i = 0 ; i < STATS_BUCKETS ; i++) atomic_init(&h->buckets[i], 0);
+  if ( (i = atomic_fetch_add(&nhists, 1)) < STATS_MAX ) hists[i] = h;
+}
+
+/* The bucket counting v: the top STATS_SUBBITS + 1 bits of it */
+static int bucket(unsigned long long v)
+{
+  int e;
+
+  if (v < 1 << STATS_SUBBITS) return v;
+  e = 63 - __builtin_clzll(v);
+  return ((e - STATS_SUBBITS + 1) << STATS_SUBBITS) +
+    (int) ((v >> (e - STATS_SUBBITS)) & ((1 << STATS_SUBBITS) - 1));
+}
+
+/* The largest value bucket b counts */
+static unsigned long long highest(int b)
+{
+  int e = (b >> STATS_SUBBITS) + STATS_SUBBITS - 1;
+  unsigned long long sub = b & ((1 << STATS_SUBBITS) - 1);
+
+  if (b < 1 << STATS_SUBBITS) return b;
+  return (((sub | 1 << STATS_SUBBITS) + 1) << (e - STATS_SUBBITS)) - 1;
+}
+
+/* Count n events that each took ns nanoseconds */
+void stats_record(struct stats_hist *h, long long ns, unsigned n)
+{
+  unsigned long long v = ns > 0 ? ns : 0;
+  unsigned long long max = atomic_load_explicit(&h->max,
+						memory_order_relaxed);
+
+  atomic_fetch_add_explicit(&h->buckets[bucket(v)], n, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, n, memory_order_relaxed);
+  while (v > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, v,
+		     memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+/*
+ * The value below which p percent of the events fell, ns, or 0 if
+ * there have been none
+ */
+long long stats_percentile(struct stats_hist *h, double p)
+{
+  unsigned long long count = atomic_load(&h->count), seen = 0, rank, max;
+  int b;
+
+  if (count == 0) return 0;
+  max = atomic_load(&h->max);
+  rank = p / 100 * count;
+  if (rank < 1) rank = 1;
+  for (b = 0 ; b < STATS_BUCKETS ; b++) {
+    seen += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+    if (seen >= rank) return highest(b) < max ? highest(b) : max;
+  }
+  return max;
+}
+
+/* Every registered histogram, one per line, in ms */
+void stats_print(FILE *f)
+{
+  int i, n = atomic_load(&nhists);
+  struct stats_hist *h;
+
+  for (i = 0 ; i < n && i < STATS_MAX ; i++) {
+    h = hists[i];
+    fprintf(f, "%-12s %9llu  p50 %8.3f  p90 %8.3f  p99 %8.3f  "
+	    "p99.9 %8.3f  max %8.3f ms\n", h->name, atomic_load(&h->count),
+	    stats_percentile(h, 50) / 1e6, stats_percentile(h, 90) / 1e6,
+	    stats_percentile(h, 99) / 1e6, stats_percentile(h, 99.9) / 1e6,
+	    atomic_load(&h->max) / 1e6);
+  }
+  fflush(f);
+}
+
+/*
+ * Write "name p50/p99 ..." for the n histograms in h, in ms, into buf.
+ * Returns the length, as snprintf does.
+ */
+int stats_line(char *buf, int size, struct stats_hist **h, int n)
+{
+  int i, len = 0;
+
+  for (i = 0 ; i < n && len < size ; i++)
+    len += snprintf(buf + len, size - len, "%s%s %.1f/%.1f", i ? " " : "",
+		    h[i]->name, stats_percentile(h[i], 50) / 1e6,
+		    stats_percentile(h[i], 99) / 1e6);
+  if (len < size)
+    len += snprintf(buf + len, size - len, " ms");
+  return len;
+}
+
+/*
+ * Note an event that happened at when.  Events at the same time (the
+ * messages from one read, say) share a mark; once the marks are full,
+ * later events are counted with the last, which is older, so the
+ * latencies are never understated.
+ */
+void stats_mark(struct stats_marks *m, long long when)
+{
+  if (m->n > 0 && (m->when[m->n - 1] == when || m->n == STATS_MARKS)) {
+    m->count[m->n - 1]++;
+    return;
+  }
+  m->when[m->n] = when;
+  m->count[m->n++] = 1;
+}
+
+/* The events in m completed at now: record them in h and forget them */
+void stats_marks_record(struct stats_hist *h, struct stats_marks *m,
+			long long now)
+{
+  int i;
+
+  for (i = 0 ; i < m->n ; i++) stats_record(h, now - m->when[i], m->count[i]);
+  m->n = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+/*
+ * Latency histograms in the style of HdrHistogram: each power of two is
+ * split into 2^STATS_SUBBITS buckets, so any value is counted within
+ * 1/2^STATS_SUBBITS of itself, from 1 ns up, in a few KiB.  Recording
+ * is an atomic add, so any thread may record into any histogram
+ * without a lock; reading the percentiles does not stop them.
+ */
+#define STATS_SUBBITS 4
+#define STATS_BUCKETS ((64 - STATS_SUBBITS + 1) << STATS_SUBBITS)
+#define STATS_MAX 16    /* Histograms registered */
+#define STATS_MARKS 16  /* Events waiting in one struct stats_marks */
+
+struct stats_hist {
+  const char *name;
+  atomic_ullong count;
+  atomic_ullong max;
+  atomic_ullong buckets[STATS_BUCKETS];
+};
+
+/* Times at which events happened, ns, waiting for them to complete */
+struct stats_marks {
+  int n;
+  long long when[STATS_MARKS];
+  unsigned count[STATS_MARKS];
+};
+
+extern long long stats_now(void);
+extern void stats_register(struct stats_hist *, const char *);
+extern void stats_record(struct stats_hist *, long long, unsigned);
+extern long long stats_percentile(struct stats_hist *, double);
+extern void stats_print(FILE *);
+extern int stats_line(char *, int, struct stats_hist **, int);
+extern void stats_mark(struct stats_marks *, long long);
+extern void stats_marks_record(struct stats_hist *, struct stats_marks *,
+			       long long);
+
+#endif
@@ -1,4 +1,5 @@
 #include "usbkeyboard.h"
+#include "eventloop.h"
 
 #include <stdio.h>
 #include <stdlib.h> 
@@ -14,69 +15,346 @@
  */
 
 /*
- * Find and return a USB keyboard device or NULL if not found
- * The argument con
- * 
+ * The keyboard is found and attached in the background.  libusb calls
+ * hotplug_f() as each device arrives or leaves, starting with those
+ * already plugged in; that only notes the device, as a hotplug
+ * callback must not do I/O.  attach_f() then runs from the event loop,
+ * a millisecond later, and looks at one noted device at a time, so
+ * messages are shown and typed from the start however many devices
+ * there are.  When the keyboard goes away, its transfers are cancelled
+ * and its handle closed, and the next keyboard to arrive is attached
+ * in its place.  The interface and endpoint of the last keyboard are
+ * remembered, so plugging it back in reads no descriptors at all.
  */
-struct libusb_device_handle *openkeyboard(uint8_t *endpoint_address) {
-  libusb_device **devs;
-  struct libusb_device_handle *keyboard = NULL;
-  struct libusb_device_descriptor desc;
-  ssize_t num_devs, d;
-  uint8_t i, k;
-  
-  /* Start the library */
-  if ( libusb_init(NULL) < 0 ) {
-    fprintf(stderr, "Error: libusb_init failed\n");
-    exit(1);
+static libusb_device *pending[USBKEYBOARD_PENDING]; /* Arrived, not looked at */
+static int npending;
+static libusb_device *device;                 /* The keyboard, or NULL */
+static struct libusb_device_handle *keyboard;
+static int interface;
+static uint8_t endpoint;
+static int unplugged;                         /* Has the keyboard gone? */
+static int attachtimer = -1;
+static usbkeyboard_plug_fn plugfn;
+static libusb_hotplug_callback_handle hotplug;
+static int hotplugging;                       /* Is hotplug registered? */
+
+/* The last keyboard attached, by vendor and product */
+static struct {
+  int valid;
+  uint16_t vendor, product;
+  int interface;
+  uint8_t endpoint;
+} known;
+
+static struct libusb_transfer *transfers[USBKEYBOARD_TRANSFERS];
+static struct usb_keyboard_packet reports[USBKEYBOARD_TRANSFERS];
+static int inflight;
+static usbkeyboard_fn reportfn;
+static int stopping;
+
+/*
+ * Let libusb handle whatever woke the event loop: completed transfers,
+ * device events and its own timeouts
+ */
+static void usbevents(int fd, uint32_t events, void *ignored)
+{
+  struct timeval zero = { 0, 0 };
+  libusb_handle_events_timeout(NULL, &zero);
+}
+
+static void pollfd_added(int fd, short events, void *ignored)
+{
+  /* POLLIN and POLLOUT have the same values as EPOLLIN and EPOLLOUT */
+  evloop_add(fd, events, usbevents, NULL);
+}
+
+static void pollfd_removed(int fd, void *ignored)
+{
+  evloop_del(fd);
+}
+
+/*
+ * Watch libusb's file descriptors from the event loop, now and as it
+ * adds and removes them.  Returns 0 on success, -1 if libusb cannot be
+ * driven this way.
+ */
+static int usbkeyboard_watch(void)
+{
+  const struct libusb_pollfd **fds;
+  int i, timer;
+
+  if ( (fds = libusb_get_pollfds(NULL)) == NULL ) return -1;
+  for (i = 0 ; fds[i] != NULL ; i++)
+    pollfd_added(fds[i]->fd, fds[i]->events, NULL);
+  libusb_free_pollfds(fds);
+  libusb_set_pollfd_notifiers(NULL, pollfd_added, pollfd_removed, NULL);
+
+  /* Without a timerfd of its own, libusb needs a poke now and then to
+     notice transfers that timed out */
+  if (!libusb_pollfds_handle_timeouts(NULL)) {
+    if ( (timer = evloop_timer(usbevents, NULL)) < 0 ) return -1;
+    evloop_arm(timer, 100, 100);
+  }
+  return 0;
+}
+
+/*
+ * Pass the report just received on and put the transfer back in the
+ * queue.  Transfers complete in the order they were submitted, so the
+ * reports arrive in order too.
+ */
+static void transfer_done(struct libusb_transfer *t)
+{
+  int i = (intptr_t) t->user_data;
+  int status = t->status;     /* t may be freed below */
+
+  if (status == LIBUSB_TRANSFER_COMPLETED &&
+      t->actual_length == sizeof(reports[i]))
+    reportfn(&reports[i]);
+
+  if (stopping || status == LIBUSB_TRANSFER_CANCELLED ||
+      status == LIBUSB_TRANSFER_NO_DEVICE ||
+      libusb_submit_transfer(t) != 0) {
+    libusb_free_transfer(t);
+    transfers[i] = NULL;
+    inflight--;
   }
 
-  /* Enumerate all the attached USB devices */
-  if ( (num_devs = libusb_get_device_list(NULL, &devs)) < 0 ) {
-    fprintf(stderr, "Error: libusb_get_device_list failed\n");
-    exit(1);
+  /* Gone: hotplug may say so too, or may not be there to */
+  if (status == LIBUSB_TRANSFER_NO_DEVICE && !stopping) {
+    unplugged = 1;
+    evloop_arm(attachtimer, 1, 0);
   }
+}
 
-  /* Look at each device, remembering the first HID device that speaks
-     the keyboard protocol */
+/*
+ * Start listening to the keyboard without blocking: reportfn is called
+ * from the event loop with each report.  Several transfers are kept
+ * queued so a report is never missed while the previous one is handled.
+ * Returns 0 on success, -1 on error.
+ */
+static int start(void)
+{
+  int i;
+  struct libusb_transfer *t;
 
-  for (d = 0 ; d < num_devs ; d++) {
-    libusb_device *dev = devs[d];
-    if ( libusb_get_device_descriptor(dev, &desc) < 0 ) {
-      fprintf(stderr, "Error: libusb_get_device_descriptor failed\n");
-      exit(1);
+  stopping = 0;
+  for (i = 0 ; i < USBKEYBOARD_TRANSFERS ; i++) {
+    if ( (t = libusb_alloc_transfer(0)) == NULL ) break;
+    libusb_fill_interrupt_transfer(t, keyboard, endpoint,
+				   (unsigned char *) &reports[i],
+				   sizeof(reports[i]), transfer_done,
+				   (void *) (intptr_t) i, 0);
+    if (libusb_submit_transfer(t) != 0) {
+      libusb_free_transfer(t);
+      break;
     }
+    transfers[i] = t;
+    inflight++;
+  }
+  if (inflight == 0) return -1;
+  return 0;
+}
+
+/*
+ * Cancel the outstanding transfers and wait for libusb to give them back
+ */
+static void stop(void)
+{
+  int i;
+
+  stopping = 1;
+  for (i = 0 ; i < USBKEYBOARD_TRANSFERS ; i++)
+    if (transfers[i] != NULL) libusb_cancel_transfer(transfers[i]);
+  while (inflight > 0)
+    if (libusb_handle_events(NULL) != 0) break;
+}
+
+/*
+ * Find the interface of dev that is a HID keyboard, and its endpoint.
+ * Returns 0 if there is one, else -1.
+ */
+static int findkeyboard(libusb_device *dev, int *iface, uint8_t *ep)
+{
+  struct libusb_device_descriptor desc;
+  struct libusb_config_descriptor *config;
+  const struct libusb_interface_descriptor *inter;
+  int i, k, found = -1;
+
+  if ( libusb_get_device_descriptor(dev, &desc) < 0 ||
+       desc.bDeviceClass != LIBUSB_CLASS_PER_INTERFACE )
+    return -1;
+  if (known.valid && desc.idVendor == known.vendor &&
+      desc.idProduct == known.product) {
+    *iface = known.interface;
+    *ep = known.endpoint;
+    return 0;
+  }
 
-    if (desc.bDeviceClass == LIBUSB_CLASS_PER_INTERFACE) {
-      struct libusb_config_descriptor *config;
-      libusb_get_config_descriptor(dev, 0, &config);
-      for (i = 0 ; i < config->bNumInterfaces ; i++)	       
-	for ( k = 0 ; k < config->interface[i].num_altsetting ; k++ ) {
-	  const struct libusb_interface_descriptor *inter =
-	    config->interface[i].altsetting + k ;
-	  if ( inter->bInterfaceClass == LIBUSB_CLASS_HID &&
-	       inter->bInterfaceProtocol == USB_HID_KEYBOARD_PROTOCOL) {
-	    int r;
-	    if ((r = libusb_open(dev, &keyboard)) != 0) {
-	      fprintf(stderr, "Error: libusb_open failed: %d\n", r);
-	      exit(1);
-	    }
-	    if (libusb_kernel_driver_active(keyboard,i))
-	      libusb_detach_kernel_driver(keyboard, i);
-	    libusb_set_auto_detach_kernel_driver(keyboard, i);
-	    if ((r = libusb_claim_interface(keyboard, i)) != 0) {
-	      fprintf(stderr, "Error: libusb_claim_interface failed: %d\n", r);
-	      exit(1);
-	    }
-	    *endpoint_address = inter->endpoint[0].bEndpointAddress;
-	    goto found;
-	  }
-	}
+  if ( libusb_get_config_descriptor(dev, 0, &config) < 0 ) return -1;
+  for (i = 0 ; i < config->bNumInterfaces && found < 0 ; i++)
+    for (k = 0 ; k < config->interface[i].num_altsetting ; k++) {
+      inter = config->interface[i].altsetting + k;
+      if ( inter->bInterfaceClass == LIBUSB_CLASS_HID &&
+	   inter->bInterfaceProtocol == USB_HID_KEYBOARD_PROTOCOL &&
+	   inter->bNumEndpoints > 0 ) {
+	*iface = i;
+	*ep = inter->endpoint[0].bEndpointAddress;
+	known.valid = 1;
+	known.vendor = desc.idVendor;
+	known.product = desc.idProduct;
+	known.interface = i;
+	known.endpoint = *ep;
+	found = 0;
+	break;
+      }
     }
+  libusb_free_config_descriptor(config);
+  return found;
+}
+
+/*
+ * Open dev, take its keyboard interface from the kernel and start
+ * reading it.  Returns 0 on success, -1 on error.
+ */
+static int attach(libusb_device *dev)
+{
+  int r;
+
+  if (findkeyboard(dev, &interface, &endpoint) < 0) return -1;
+  if ((r = libusb_open(dev, &keyboard)) != 0) {
+    fprintf(stderr, "Could not open the keyboard: %d\n", r);
+    keyboard = NULL;
+    return -1;
+  }
+  if (libusb_kernel_driver_active(keyboard, interface) == 1)
+    libusb_detach_kernel_driver(keyboard, interface);
+  libusb_set_auto_detach_kernel_driver(keyboard, interface);
+  if ((r = libusb_claim_interface(keyboard, interface)) != 0) {
+    fprintf(stderr, "Could not claim the keyboard: %d\n", r);
+    libusb_close(keyboard);
+    keyboard = NULL;
+    return -1;
+  }
+  if (start() < 0) {
+    fprintf(stderr, "Could not start reading the keyboard\n");
+    libusb_release_interface(keyboard, interface);
+    libusb_close(keyboard);
+    keyboard = NULL;
+    return -1;
+  }
+  device = libusb_ref_device(dev);
+  unplugged = 0;
+  if (plugfn != NULL) plugfn(1);
+  return 0;
+}
+
+/*
+ * Let go of the keyboard, gone or not
+ */
+static void detach(void)
+{
+  stop();
+  if (!unplugged) libusb_release_interface(keyboard, interface);
+  libusb_close(keyboard);
+  libusb_unref_device(device);
+  keyboard = NULL;
+  device = NULL;
+  if (plugfn != NULL) plugfn(0);
+}
+
+/*
+ * Note a device that arrived, or forget one that left before it was
+ * looked at; deal with either from the event loop
+ */
+static int hotplug_f(libusb_context *ctx, libusb_device *dev,
+		     libusb_hotplug_event event, void *ignored)
+{
+  int i;
+
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+    if (npending < USBKEYBOARD_PENDING)
+      pending[npending++] = libusb_ref_device(dev);
+  } else if (dev == device)
+    unplugged = 1;
+  else
+    for (i = 0 ; i < npending ; i++)
+      if (pending[i] == dev) {
+	libusb_unref_device(dev);
+	pending[i] = pending[--npending];
+	break;
+      }
+  evloop_arm(attachtimer, 1, 0);
+  return 0;
+}
+
+/*
+ * Let go of a keyboard that has gone, then try the next device that
+ * arrived, if there is no keyboard
+ */
+static void attach_f(int fd, uint32_t events, void *ignored)
+{
+  libusb_device *dev;
+
+  if (keyboard != NULL && unplugged) detach();
+  if (keyboard != NULL || npending == 0) return;
+
+  dev = pending[--npending];
+  attach(dev);
+  libusb_unref_device(dev);
+  if (keyboard == NULL && npending > 0) evloop_arm(attachtimer, 1, 0);
+}
+
+/*
+ * Start looking for a keyboard: fn is called from the event loop with
+ * each report it sends, and plugged, if not NULL, with 1 when one is
+ * attached and 0 when it goes away.  Returns at once, before any is
+ * found; without hotplug support, only the devices plugged in now are
+ * looked at.  Must be called after evloop_init().  Returns 0 on
+ * success, -1 if libusb cannot be used.
+ */
+int usbkeyboard_open(usbkeyboard_fn fn, usbkeyboard_plug_fn plugged)
+{
+  libusb_device **devs;
+  ssize_t num_devs, d;
+
+  reportfn = fn;
+  plugfn = plugged;
+  if ( libusb_init(NULL) < 0 ) return -1;
+  if ( usbkeyboard_watch() < 0 ||
+       (attachtimer = evloop_timer(attach_f, NULL)) < 0 )
+    return -1;
+
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    if ( libusb_hotplug_register_callback(NULL,
+	   LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+	   LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY,
+	   LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_CLASS_PER_INTERFACE,
+	   hotplug_f, NULL, &hotplug) != LIBUSB_SUCCESS )
+      return -1;
+    hotplugging = 1;
+    return 0;
   }
 
- found:
+  /* No hotplug: look at what is plugged in now, and only that */
+  if ( (num_devs = libusb_get_device_list(NULL, &devs)) < 0 ) return -1;
+  for (d = 0 ; d < num_devs ; d++)
+    hotplug_f(NULL, devs[d], LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, NULL);
   libusb_free_device_list(devs, 1);
+  return 0;
+}
 
-  return keyboard;
+/*
+ * Stop looking for a keyboard, and let go of the one attached
+ */
+void usbkeyboard_close(void)
+{
+  if (hotplugging) libusb_hotplug_deregister_callback(NULL, hotplug);
+  hotplugging = 0;
+  if (keyboard != NULL) {
+    plugfn = NULL;
+    detach();
+  }
+  while (npending > 0)
+    libusb_unref_device(pending[--npending]);
 }
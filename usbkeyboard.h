@@ -2,28 +2,20 @@
 #define _USBKEYBOARD_H
 
 #include <libusb-1.0/libusb.h>
+#include "keyboard.h"
 
 #define USB_HID_KEYBOARD_PROTOCOL 1
 
-/* Modifier bits */
-#define USB_LCTRL  (1 << 0)
-#define USB_LSHIFT (1 << 1)
-#define USB_LALT   (1 << 2)
-#define USB_LGUI   (1 << 3)
-#define USB_RCTRL  (1 << 4)
-#define USB_RSHIFT (1 << 5)
-#define USB_RALT   (1 << 6) 
-#define USB_RGUI   (1 << 7)
+#define USBKEYBOARD_TRANSFERS 4  /* Interrupt transfers kept in flight */
+#define USBKEYBOARD_PENDING 64   /* Devices noted, waiting to be looked at */
 
-struct usb_keyboard_packet {
-  uint8_t modifiers;
-  uint8_t reserved;
-  uint8_t keycode[6];
-};
+/* Called from the event loop with each report the keyboard sends */
+typedef void (*usbkeyboard_fn)(const struct usb_keyboard_packet *);
 
-/* Find and open a USB keyboard device.  Argument should point to
-   space to store an endpoint address.  Returns NULL if no keyboard
-   device was found. */
-extern struct libusb_device_handle *openkeyboard(uint8_t *);
+/* Called with 1 when a keyboard is attached, 0 when it goes away */
+typedef void (*usbkeyboard_plug_fn)(int);
+
+extern int usbkeyboard_open(usbkeyboard_fn, usbkeyboard_plug_fn);
+extern void usbkeyboard_close(void);
 
 #endif
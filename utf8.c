@@ -0,0 +1,77 @@
+/*
+ * Streaming UTF-8 decoder
+ */
+#include "utf8.h"
+
+void utf8_init(struct utf8 *u)
+{
+  u->cp = 0;
+  u->min = 0;
+  u->need = 0;
+  u->errors = 0;
+}
+
+/*
+ * Decode n bytes, storing the characters completed in out, which must
+ * have room for n + 1 of them.  Returns the number stored.
+ */
+int utf8_decode(struct utf8 *u, const char *s, int n, uint32_t *out)
+{
+  uint32_t *o = out;
+  unsigned char c;
+  int bad;
+
+  while (n-- > 0) {
+    c = *s++;
+
+    if (u->need > 0) {
+      if ((c & 0xc0) == 0x80) {
+	u->cp = u->cp << 6 | (c & 0x3f);
+	if (--u->need == 0) {
+	  bad = u->cp < u->min || u->cp > 0x10ffff ||
+	    (u->cp >= 0xd800 && u->cp <= 0xdfff);
+	  u->errors += bad;
+	  *o++ = bad ? UTF8_REPLACEMENT : u->cp;
+	}
+	continue;
+      }
+      /* Cut short: the byte starts something new */
+      *o++ = UTF8_REPLACEMENT;
+      u->errors++;
+      u->need = 0;
+    }
+
+    if (c < 0x80)
+      *o++ = c;
+    else if ((c & 0xe0) == 0xc0) {
+      u->cp = c & 0x1f;
+      u->min = 0x80;
+      u->need = 1;
+    } else if ((c & 0xf0) == 0xe0) {
+      u->cp = c & 0x0f;
+      u->min = 0x800;
+      u->need = 2;
+    } else if ((c & 0xf8) == 0xf0) {
+      u->cp = c & 0x07;
+      u->min = 0x10000;
+      u->need = 3;
+    } else {
+      *o++ = UTF8_REPLACEMENT;
+      u->errors++;
+    }
+  }
+  return o - out;
+}
+
+/*
+ * End of the stream: a character left unfinished decodes as U+FFFD.
+ * Returns the number of characters stored in out (0 or 1).
+ */
+int utf8_finish(struct utf8 *u, uint32_t *out)
+{
+  if (u->need == 0) return 0;
+  u->need = 0;
+  u->errors++;
+  *out = UTF8_REPLACEMENT;
+  return 1;
+}
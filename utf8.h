@@ -0,0 +1,25 @@
+#ifndef _UTF8_H
+#define _UTF8_H
+
+#include <stdint.h>
+
+#define UTF8_REPLACEMENT 0xfffd  /* Stands in for anything malformed */
+
+/*
+ * A UTF-8 decoder that can be fed a byte stream in pieces: a character
+ * split between two calls is finished by the second.  Malformed input
+ * (stray continuation bytes, overlong forms, surrogates, codepoints
+ * past U+10FFFF, truncated sequences) decodes as U+FFFD.
+ */
+struct utf8 {
+  uint32_t cp;   /* Bits of the character so far */
+  uint32_t min;  /* Smallest codepoint its length may encode */
+  int need;      /* Continuation bytes still to come */
+  unsigned long errors;  /* Malformed sequences seen */
+};
+
+extern void utf8_init(struct utf8 *);
+extern int utf8_decode(struct utf8 *, const char *, int, uint32_t *);
+extern int utf8_finish(struct utf8 *, uint32_t *);
+
+#endif